@@ -3,4 +3,10 @@
 #define VERSION_MAJOR		1
 #define VERSION_MINOR		1
 
-#define KEY_FIFO_SIZE		31       // number of keys in the public FIFO
+#define KEY_FIFO_SIZE		256      // size of the public key FIFO, must be a power of 2, holds one less key
+
+#define EVENT_RING_SIZE		64       // size of the typed event stream, must be a power of 2
+
+#define KEY_SCAN_PIO		1        // scan the key matrix with PIO + DMA, 0 falls back to scanning it from a timer
+
+#define INPUT_ON_CORE1		0        // run the keyboard scan and the touchpad on core1, handing the events over to core0
@@ -0,0 +1,111 @@
+#include "debounce.h"
+
+#include "reg.h"
+
+#define COUNTER_BITS	12 // vertical counter width, the debounce time is at most 2^12 - 1 scans
+
+// Every key gets a COUNTER_BITS wide counter, stored bit-sliced: cnt[i] holds bit i of all the
+// counters, so a whole scan is debounced with a handful of 64-bit operations.
+static struct
+{
+	uint64_t state;  // debounced state
+	uint64_t locked; // eager mode: keys that changed recently and ignore any further change
+	uint64_t cnt[COUNTER_BITS];
+	uint32_t samples;
+	bool eager;
+} self;
+
+// add 1 to the counters selected by mask
+static void counters_increment(uint64_t mask)
+{
+	for (uint32_t i = 0; (i < COUNTER_BITS) && mask; ++i) {
+		const uint64_t carry = self.cnt[i] & mask;
+
+		self.cnt[i] ^= mask;
+		mask = carry;
+	}
+}
+
+// returns the keys in mask whose counter is equal to value
+static uint64_t counters_equal(uint64_t mask, uint32_t value)
+{
+	for (uint32_t i = 0; i < COUNTER_BITS; ++i)
+		mask &= ((value >> i) & 1) ? self.cnt[i] : ~self.cnt[i];
+
+	return mask;
+}
+
+static void counters_clear(uint64_t mask)
+{
+	for (uint32_t i = 0; i < COUNTER_BITS; ++i)
+		self.cnt[i] &= ~mask;
+}
+
+static uint32_t debounce_samples(uint32_t period_us)
+{
+	const uint32_t deb_us = reg_get_value(REG_ID_DEB) * 1000;
+
+	// round up, the debounce time is a minimum
+	const uint32_t samples = (deb_us + period_us - 1) / period_us;
+
+	return (samples < (1 << COUNTER_BITS)) ? samples : ((1 << COUNTER_BITS) - 1);
+}
+
+uint64_t debounce_update(uint64_t raw, uint32_t period_us)
+{
+	const uint32_t samples = debounce_samples(period_us);
+	const bool eager = reg_is_bit_set(REG_ID_CF2, CF2_EAGER_DEBOUNCE);
+
+	// the counters only ever test for equality and mean something else in each mode,
+	// start over when the target or the mode changes
+	if ((samples != self.samples) || (eager != self.eager)) {
+		counters_clear(UINT64_MAX);
+		self.locked = 0;
+		self.samples = samples;
+		self.eager = eager;
+	}
+
+	if (samples == 0) {
+		self.state = raw;
+		return self.state;
+	}
+
+	if (eager) {
+		// locked keys count the scans since their last change and get released after enough of them
+		counters_increment(self.locked);
+
+		const uint64_t expired = counters_equal(self.locked, samples);
+		counters_clear(expired);
+		self.locked &= ~expired;
+
+		// the first edge of an unlocked key goes through right away, then the key gets locked
+		const uint64_t changed = (raw ^ self.state) & ~self.locked;
+		self.state ^= changed;
+		self.locked |= changed;
+	} else {
+		// keys that agree with the debounced state start counting over, the others count up
+		const uint64_t delta = (raw ^ self.state);
+		counters_clear(~delta);
+		counters_increment(delta);
+
+		// and are accepted once they stayed the same for enough scans
+		const uint64_t stable = counters_equal(delta, samples);
+		counters_clear(stable);
+		self.state ^= stable;
+	}
+
+	return self.state;
+}
+
+bool debounce_is_busy(void)
+{
+	if (self.locked)
+		return true;
+
+	for (uint32_t i = 0; i < COUNTER_BITS; ++i) {
+		if (self.cnt[i])
+			return true;
+	}
+
+	return false;
+}
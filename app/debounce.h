@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+uint64_t debounce_update(uint64_t raw, uint32_t period_us);
+bool debounce_is_busy(void);
@@ -29,7 +29,7 @@ static void key_lock_cb(bool caps_changed, bool num_changed)
 }
 static struct key_lock_callback key_lock_callback ={ .func = key_lock_cb };
 
-static void touch_cb(int8_t x, int8_t y)
+static void touch_cb(int16_t x, int16_t y)
 {
 	printf("%s: x: %d, y: %d !\r\n", __func__, x, y);
 }
@@ -0,0 +1,131 @@
+#include "events.h"
+
+#include "app_config.h"
+#include "gpioexp.h"
+#include "keyboard.h"
+#include "reg.h"
+#include "touchpad.h"
+
+#include <hardware/sync.h>
+#include <pico/stdlib.h>
+
+#define RING_MASK			(EVENT_RING_SIZE - 1)
+
+_Static_assert((EVENT_RING_SIZE & RING_MASK) == 0, "EVENT_RING_SIZE must be a power of 2");
+
+// Events come in from the input dispatch and the gpio irq and go out through the I2C and USB
+// register reads, so unlike the key FIFO the ring is only ever touched with interrupts off.
+static struct
+{
+	struct event events[EVENT_RING_SIZE];
+	uint32_t head;
+	uint32_t tail;
+} self;
+
+uint16_t events_count(void)
+{
+	const uint32_t irq_state = save_and_disable_interrupts();
+	const uint16_t count = (uint16_t)(self.head - self.tail);
+	restore_interrupts(irq_state);
+
+	return count;
+}
+
+void events_flush(void)
+{
+	const uint32_t irq_state = save_and_disable_interrupts();
+	self.tail = self.head;
+	restore_interrupts(irq_state);
+}
+
+void events_push(enum event_type type, uint8_t data0, uint8_t data1, uint8_t data2)
+{
+	if (!reg_is_bit_set(REG_ID_CF2, CF2_EVENT_STREAM))
+		return;
+
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	bool push = true;
+
+	// same overflow handling as the key FIFO
+	if ((self.head - self.tail) >= EVENT_RING_SIZE) {
+		if (reg_is_bit_set(REG_ID_CFG, CFG_OVERFLOW_INT))
+			reg_set_bit(REG_ID_INT, INT_OVERFLOW);
+
+		if (reg_is_bit_set(REG_ID_CFG, CFG_OVERFLOW_ON))
+			self.tail++;
+		else
+			push = false;
+	}
+
+	if (push) {
+		struct event * const event = &self.events[self.head & RING_MASK];
+
+		event->type = type;
+		event->data[0] = data0;
+		event->data[1] = data1;
+		event->data[2] = data2;
+
+		self.head++;
+	}
+
+	restore_interrupts(irq_state);
+}
+
+struct event events_pop(void)
+{
+	struct event event = { .type = EVT_NONE };
+
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	if (self.tail != self.head) {
+		event = self.events[self.tail & RING_MASK];
+		self.tail++;
+	}
+
+	restore_interrupts(irq_state);
+
+	return event;
+}
+
+static void touch_cb(int16_t x, int16_t y)
+{
+	// 12-bit deltas, the high nibbles go together like in the sensor's DELTA_XY_H
+	events_push(EVT_MOTION, (uint8_t)x, (uint8_t)y, (uint8_t)((((uint16_t)x >> 4) & 0xF0) | (((uint16_t)y >> 8) & 0x0F)));
+}
+static struct touch_callback touch_callback = { .func = touch_cb };
+
+static void gpioexp_cb(uint8_t gpio, uint8_t gpio_idx)
+{
+	// gpio edges count as a source for the event filters, see keyboard.c for keys
+	if (!reg_is_bit_set(REG_ID_FIS, FLT_SRC_GPIO) && !reg_is_bit_set(REG_ID_FVS, FLT_SRC_GPIO))
+		return;
+
+	events_push(EVT_GPIO, gpio_idx, gpio_get(gpio), 0);
+}
+static struct gpioexp_callback gpioexp_callback = { .func = gpioexp_cb };
+
+static void key_lock_cb(bool caps_changed, bool num_changed)
+{
+	uint8_t state = 0;
+	state |= keyboard_get_capslock() ? KEY_CAPSLOCK : 0x00;
+	state |= keyboard_get_numlock()  ? KEY_NUMLOCK  : 0x00;
+
+	uint8_t changed = 0;
+	changed |= caps_changed ? KEY_CAPSLOCK : 0x00;
+	changed |= num_changed  ? KEY_NUMLOCK  : 0x00;
+
+	events_push(EVT_LOCK, state, changed, 0);
+}
+static struct key_lock_callback key_lock_callback = { .func = key_lock_cb };
+
+void events_init(void)
+{
+	// keys are pushed by keyboard.c itself, along with the FIFO
+
+	keyboard_add_lock_callback(&key_lock_callback);
+
+	touchpad_add_touch_callback(&touch_callback);
+
+	gpioexp_add_int_callback(&gpioexp_callback);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+enum event_type
+{
+	EVT_NONE = 0, // nothing left to read
+	EVT_KEY,      // key state, key code, source
+	EVT_MOTION,   // trackpad x and y deltas
+	EVT_GPIO,     // gpio expander pin index, level
+	EVT_LOCK,     // lock state, changed locks, using the REG_ID_KEY bits
+};
+
+// a tagged record, the data depends on the type
+struct event
+{
+	uint8_t type;
+	uint8_t data[3];
+};
+
+uint16_t events_count(void);
+void events_flush(void);
+void events_push(enum event_type type, uint8_t data0, uint8_t data1, uint8_t data2);
+struct event events_pop(void);
+
+void events_init(void);
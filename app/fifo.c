@@ -1,60 +1,147 @@
 #include "app_config.h"
 #include "fifo.h"
 
+#include <hardware/sync.h>
+
+#define FIFO_MASK			(KEY_FIFO_SIZE - 1)
+
+// events are packed into 2 bytes, the key in the low byte and the state in the high one
+#define EVENT_PACK(k, s)	((uint16_t)(((uint8_t)(s) << 8) | (uint8_t)(k)))
+#define EVENT_KEY(e)		((char)((e) & 0xFF))
+#define EVENT_STATE(e)		((enum key_state)((e) >> 8))
+
+_Static_assert((KEY_FIFO_SIZE & FIFO_MASK) == 0, "KEY_FIFO_SIZE must be a power of 2");
+_Static_assert(KEY_FIFO_SIZE >= 2, "KEY_FIFO_SIZE must be at least 2");
+_Static_assert(FIFO_READER_LAST <= 8, "Readers have to fit a byte");
+
+// Single producer (the key event dispatch) and single consumer (the register reads) ring. The
+// indices run freely and are only masked to access the slots, each side only writes its own.
+//
+// One slot is always kept free: it's the one the producer writes next, and the only one it can
+// be writing to while the consumer reads. When forced, the producer overwrites the oldest
+// events without touching the tail, the consumer notices and skips over them instead.
+struct ring
+{
+	uint16_t events[KEY_FIFO_SIZE];
+	uint32_t times[KEY_FIFO_SIZE];
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	volatile bool overflow;
+};
+
+// Every reader gets a ring of its own, so one that falls behind can't make another one lose
+// events, and a full FIFO drops the new events for that reader only.
 static struct
 {
-	struct fifo_item fifo[KEY_FIFO_SIZE];
-	uint8_t count;
-	uint8_t read_idx;
-	uint8_t write_idx;
+	struct ring rings[FIFO_READER_LAST];
 } self;
 
-uint8_t fifo_count(void)
+static uint32_t fifo_used(uint32_t head, uint32_t tail)
 {
-	return self.count;
+	// the oldest events got overwritten by a forced enqueue
+	if ((head - tail) > (KEY_FIFO_SIZE - 1))
+		return (KEY_FIFO_SIZE - 1);
+
+	return (head - tail);
 }
 
-void fifo_flush(void)
+static void ring_write(struct ring *ring, const struct fifo_item item)
 {
-	self.write_idx = 0;
-	self.read_idx = 0;
-	self.count = 0;
+	const uint32_t head = ring->head;
+
+	ring->events[head & FIFO_MASK] = EVENT_PACK(item.key, item.state);
+	ring->times[head & FIFO_MASK] = item.time;
+	__dmb();
+
+	ring->head = head + 1;
 }
 
-bool fifo_enqueue(const struct fifo_item item)
+uint16_t fifo_count(enum fifo_reader reader)
 {
-	if (self.count >= KEY_FIFO_SIZE)
-		return false;
+	const struct ring *ring = &self.rings[reader];
 
-	self.fifo[self.write_idx++] = item;
+	return fifo_used(ring->head, ring->tail);
+}
 
-	self.write_idx %= KEY_FIFO_SIZE;
-	++self.count;
+void fifo_flush(enum fifo_reader reader)
+{
+	struct ring *ring = &self.rings[reader];
 
-	return true;
+	ring->tail = ring->head;
 }
 
-void fifo_enqueue_force(const struct fifo_item item)
+uint8_t fifo_enqueue(const struct fifo_item item, bool force)
 {
-	if (fifo_enqueue(item))
-		return;
+	uint8_t full = 0;
+
+	for (uint8_t i = 0; i < FIFO_READER_LAST; ++i) {
+		struct ring *ring = &self.rings[i];
+
+		if (!(item.readers & FIFO_READER_BIT(i)))
+			continue;
+
+		if ((ring->head - ring->tail) >= (KEY_FIFO_SIZE - 1)) {
+			full |= FIFO_READER_BIT(i);
+			ring->overflow = true;
+
+			if (!force)
+				continue;
+		}
 
-	self.fifo[self.write_idx++] = item;
-	self.write_idx %= KEY_FIFO_SIZE;
+		ring_write(ring, item);
+	}
 
-	self.read_idx++;
-	self.read_idx %= KEY_FIFO_SIZE;
+	return full;
 }
 
-struct fifo_item fifo_dequeue(void)
+struct fifo_item fifo_dequeue(enum fifo_reader reader)
 {
+	struct ring *ring = &self.rings[reader];
 	struct fifo_item item = { 0 };
-	if (self.count == 0)
+
+	while (true) {
+		const uint32_t head = ring->head;
+		const uint32_t tail = head - fifo_used(head, ring->tail);
+
+		if (tail == head)
+			return item;
+
+		__dmb();
+
+		const uint16_t event = ring->events[tail & FIFO_MASK];
+		const uint32_t time = ring->times[tail & FIFO_MASK];
+
+		__dmb();
+
+		// the producer came around and started rewriting the slot while we read it, try again
+		if ((ring->head - tail) >= KEY_FIFO_SIZE)
+			continue;
+
+		item.key = EVENT_KEY(event);
+		item.state = EVENT_STATE(event);
+		item.time = time;
+		item.readers = FIFO_READER_BIT(reader);
+
+		ring->tail = tail + 1;
+
 		return item;
+	}
+}
+
+void fifo_mark_overflow(uint8_t readers)
+{
+	for (uint8_t i = 0; i < FIFO_READER_LAST; ++i) {
+		if (readers & FIFO_READER_BIT(i))
+			self.rings[i].overflow = true;
+	}
+}
+
+bool fifo_take_overflow(enum fifo_reader reader)
+{
+	struct ring *ring = &self.rings[reader];
+	const bool overflow = ring->overflow;
 
-	item = self.fifo[self.read_idx++];
-	self.read_idx %= KEY_FIFO_SIZE;
-	--self.count;
+	ring->overflow = false;
 
-	return item;
+	return overflow;
 }
@@ -2,14 +2,36 @@
 
 #include "keyboard.h"
 
+// every host reading the FIFO has its own queue, so they all get every event they want
+enum fifo_reader
+{
+	FIFO_READER_I2C = 0,
+	FIFO_READER_USB, // usb vendor interface
+
+	FIFO_READER_LAST,
+};
+
+#define FIFO_READER_BIT(r)	(1 << (r))
+#define FIFO_READERS_ALL	((1 << FIFO_READER_LAST) - 1)
+
+// what goes in and out of the FIFO, it's stored packed
 struct fifo_item
 {
 	char key;
 	enum key_state state;
+	uint32_t time; // us since boot when the event was captured
+	uint8_t readers; // FIFO_READER_BIT of the readers the event goes to
 };
 
-uint8_t fifo_count(void);
-void fifo_flush(void);
-bool fifo_enqueue(const struct fifo_item item);
-void fifo_enqueue_force(const struct fifo_item item);
-struct fifo_item fifo_dequeue(void);
+uint16_t fifo_count(enum fifo_reader reader);
+void fifo_flush(enum fifo_reader reader);
+
+// returns the readers that had no room left, they miss the event, or with force their oldest one
+uint8_t fifo_enqueue(const struct fifo_item item, bool force);
+struct fifo_item fifo_dequeue(enum fifo_reader reader);
+
+// whether the reader missed any event since the last call
+bool fifo_take_overflow(enum fifo_reader reader);
+
+// the readers missed events before they even got to the FIFO
+void fifo_mark_overflow(uint8_t readers);
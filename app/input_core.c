@@ -0,0 +1,173 @@
+#include "input_core.h"
+
+#include "app_config.h"
+#include "fifo.h"
+#include "keyboard.h"
+#include "reg.h"
+#include "touchpad.h"
+
+#include <pico/stdlib.h>
+
+#if INPUT_ON_CORE1
+#include <hardware/irq.h>
+#include <hardware/sync.h>
+#include <pico/multicore.h>
+
+#define RING_SIZE			64 // must be a power of 2
+#define CORE1_HW_ALARM		2  // the default alarm pool uses 3
+
+struct deferred_call
+{
+	input_core_func_t func;
+	uint16_t a;
+	uint16_t b;
+	uint32_t time;
+};
+
+// The ring has a single producer, the core1 irqs (which don't preempt each other), and a single
+// consumer, the core0 SIO irq. Each side only ever writes its own index.
+static struct
+{
+	struct deferred_call ring[RING_SIZE];
+	volatile uint32_t head;
+	volatile uint32_t tail;
+
+	volatile uint32_t dropped; // calls that didn't fit the ring, only ever written by core1
+	uint32_t dropped_seen;
+
+	alarm_pool_t *alarm_pool;
+} self;
+
+static void core1_gpio_irq(uint gpio, uint32_t events)
+{
+	keyboard_gpio_irq(gpio, events);
+	touchpad_gpio_irq(gpio, events);
+}
+
+static void core1_entry(void)
+{
+	// the irqs get enabled on the core that sets them up, so all of the input lands on core1
+	self.alarm_pool = alarm_pool_create(CORE1_HW_ALARM, 16);
+
+	// lets core0 park us while it writes to flash
+	multicore_lockout_victim_init();
+
+	keyboard_init();
+
+	touchpad_init();
+
+	gpio_set_irq_enabled_with_callback(0xFF, 0, true, &core1_gpio_irq);
+
+	while (true) {
+		__wfe();
+	}
+}
+
+static void core0_sio_irq(void)
+{
+	// the inter-core FIFO is only used as a doorbell, drain it before looking at the ring so
+	// that anything pushed after this point rings again
+	multicore_fifo_drain();
+	multicore_fifo_clear_irq();
+
+	uint32_t tail = self.tail;
+	while (tail != self.head) {
+		__dmb();
+
+		const struct deferred_call call = self.ring[tail & (RING_SIZE - 1)];
+
+		self.tail = ++tail;
+
+		call.func(call.a, call.b, call.time);
+	}
+
+	// a release may be among the lost calls, so a key can look stuck, the hosts have to know
+	const uint32_t dropped = self.dropped;
+	if (dropped != self.dropped_seen) {
+		self.dropped_seen = dropped;
+
+		fifo_mark_overflow(FIFO_READERS_ALL);
+
+		if (reg_is_bit_set(REG_ID_CFG, CFG_OVERFLOW_INT))
+			reg_set_bit(REG_ID_INT, INT_OVERFLOW);
+	}
+}
+
+void input_core_defer(input_core_func_t func, uint16_t a, uint16_t b)
+{
+	const uint32_t time = time_us_32();
+
+	if (get_core_num() == 0) {
+		func(a, b, time);
+		return;
+	}
+
+	const uint32_t head = self.head;
+
+	if ((head - self.tail) >= RING_SIZE) {
+		// core0 is way behind, there's nothing better to do than to drop the call, but it
+		// gets rung anyway to report the loss
+		self.dropped++;
+	} else {
+		self.ring[head & (RING_SIZE - 1)] = (struct deferred_call){ func, a, b, time };
+		__dmb();
+		self.head = head + 1;
+	}
+
+	// if the FIFO is full core0 hasn't drained it yet and will see this entry anyway
+	if (multicore_fifo_wready())
+		multicore_fifo_push_blocking(0);
+}
+
+alarm_pool_t *input_core_get_alarm_pool(void)
+{
+	return self.alarm_pool;
+}
+
+void input_core_pause(void)
+{
+	multicore_lockout_start_blocking();
+}
+
+void input_core_resume(void)
+{
+	multicore_lockout_end_blocking();
+
+	// the lockout handshake throws away any doorbell that came in meanwhile, have a look anyway
+	irq_set_pending(SIO_IRQ_PROC0);
+}
+
+void input_core_init(void)
+{
+	multicore_launch_core1(core1_entry);
+
+	// launching core1 uses the FIFO too, so only take it over once that's done
+	irq_set_exclusive_handler(SIO_IRQ_PROC0, core0_sio_irq);
+	irq_set_enabled(SIO_IRQ_PROC0, true);
+}
+#else
+void input_core_defer(input_core_func_t func, uint16_t a, uint16_t b)
+{
+	func(a, b, time_us_32());
+}
+
+alarm_pool_t *input_core_get_alarm_pool(void)
+{
+	return alarm_pool_get_default();
+}
+
+void input_core_pause(void)
+{
+}
+
+void input_core_resume(void)
+{
+}
+
+void input_core_init(void)
+{
+	keyboard_init();
+
+	touchpad_init();
+}
+#endif
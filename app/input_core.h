@@ -0,0 +1,20 @@
+#pragma once
+
+#include <pico/time.h>
+#include <stdint.h>
+
+// the last parameter is the time the call was deferred at, in us since boot
+typedef void (*input_core_func_t)(uint16_t, uint16_t, uint32_t);
+
+// Run func on core0. When the input pipeline runs on core1 the call is queued and executed
+// from core0's SIO irq, otherwise it's called right away.
+void input_core_defer(input_core_func_t func, uint16_t a, uint16_t b);
+
+// Alarm pool serviced by the core running the input pipeline
+alarm_pool_t *input_core_get_alarm_pool(void);
+
+// Keep core1 from running anything (from flash) until resumed, no-ops without core1
+void input_core_pause(void);
+void input_core_resume(void);
+
+void input_core_init(void);
@@ -1,6 +1,8 @@
 #include "interrupt.h"
 
 #include "app_config.h"
+#include "events.h"
+#include "fifo.h"
 #include "gpioexp.h"
 #include "keyboard.h"
 #include "reg.h"
@@ -8,6 +10,99 @@
 
 #include <pico/stdlib.h>
 
+static struct
+{
+	volatile bool pulse_active;
+	bool level_active;
+
+	uint32_t pending;       // events held back since the last pulse
+	alarm_id_t holdoff_alarm;
+} self;
+
+static int64_t pulse_end(alarm_id_t id, void *user_data)
+{
+	(void)id;
+	(void)user_data;
+
+	// the mode got switched to level in the middle of the pulse
+	if (!self.level_active)
+		gpio_put(PIN_INT, 1);
+
+	self.pulse_active = false;
+
+	return 0;
+}
+
+// Pull the pin low for REG_ID_IND ms, an alarm releases it so the caller doesn't have to wait.
+// Anything raised while a pulse is going on merges into it, the host reads REG_ID_INT anyway.
+static void pulse(void)
+{
+	if (self.pulse_active)
+		return;
+
+	self.pulse_active = true;
+	gpio_put(PIN_INT, 0);
+
+	// no alarm slot left, a short pulse beats a stuck pin
+	if (add_alarm_in_us(reg_get_value(REG_ID_IND) * 1000, pulse_end, NULL, true) < 0)
+		pulse_end(0, NULL);
+}
+
+// In level mode the pin stays low from here until the host is done, see interrupt_sync
+static void level_assert(void)
+{
+	self.level_active = true;
+	gpio_put(PIN_INT, 0);
+}
+
+// signal everything held back so far
+static void flush(void)
+{
+	if (self.holdoff_alarm > 0) {
+		cancel_alarm(self.holdoff_alarm);
+		self.holdoff_alarm = 0;
+	}
+
+	self.pending = 0;
+
+	if (reg_is_bit_set(REG_ID_CF2, CF2_INT_LEVEL))
+		level_assert();
+	else
+		pulse();
+}
+
+static int64_t holdoff_expired(alarm_id_t id, void *user_data)
+{
+	(void)id;
+	(void)user_data;
+
+	self.holdoff_alarm = 0;
+
+	flush();
+
+	return 0;
+}
+
+// Hold events back until REG_ID_IWM of them are pending, or the oldest one waited REG_ID_IHO ms
+static void coalesce(void)
+{
+	self.pending++;
+
+	if (self.pending >= reg_get_value(REG_ID_IWM)) {
+		flush();
+		return;
+	}
+
+	// the first event held back starts the clock
+	if ((self.pending == 1) && (reg_get_value(REG_ID_IHO) > 0)) {
+		self.holdoff_alarm = add_alarm_in_ms(reg_get_value(REG_ID_IHO), holdoff_expired, NULL, true);
+
+		// no alarm slot left, don't risk holding on to the event forever
+		if (self.holdoff_alarm < 0)
+			flush();
+	}
+}
+
 static void key_cb(char key, enum key_state state)
 {
 	(void)key;
@@ -18,11 +113,9 @@ static void key_cb(char key, enum key_state state)
 
 	reg_set_bit(REG_ID_INT, INT_KEY);
 
-	gpio_put(PIN_INT, 0);
-	busy_wait_ms(reg_get_value(REG_ID_IND));
-	gpio_put(PIN_INT, 1);
+	coalesce();
 }
-static struct key_callback key_callback = { .func = key_cb };
+static struct key_callback key_callback = { .func = key_cb, .filter_reg = REG_ID_FIK }; // only for what the host gets
 
 static void key_lock_cb(bool caps_changed, bool num_changed)
 {
@@ -38,15 +131,13 @@ static void key_lock_cb(bool caps_changed, bool num_changed)
 		do_int = true;
 	}
 
-	if (do_int) {
-		gpio_put(PIN_INT, 0);
-		busy_wait_ms(reg_get_value(REG_ID_IND));
-		gpio_put(PIN_INT, 1);
-	}
+	// lock changes are rare, no need to hold them back
+	if (do_int)
+		flush();
 }
 static struct key_lock_callback key_lock_callback = { .func = key_lock_cb };
 
-static void touch_cb(int8_t x, int8_t y)
+static void touch_cb(int16_t x, int16_t y)
 {
 	(void)x;
 	(void)y;
@@ -56,9 +147,7 @@ static void touch_cb(int8_t x, int8_t y)
 
 	reg_set_bit(REG_ID_INT, INT_TOUCH);
 
-	gpio_put(PIN_INT, 0);
-	busy_wait_ms(reg_get_value(REG_ID_IND));
-	gpio_put(PIN_INT, 1);
+	coalesce();
 }
 static struct touch_callback touch_callback = { .func = touch_cb };
 
@@ -72,12 +161,25 @@ static void gpioexp_cb(uint8_t gpio, uint8_t gpio_idx)
 	reg_set_bit(REG_ID_INT, INT_GPIO);
 	reg_set_bit(REG_ID_GIN, (1 << gpio_idx));
 
-	gpio_put(PIN_INT, 0);
-	busy_wait_ms(reg_get_value(REG_ID_IND));
-	gpio_put(PIN_INT, 1);
+	coalesce();
 }
 static struct gpioexp_callback gpioexp_callback = { .func = gpioexp_cb };
 
+void interrupt_sync(void)
+{
+	if (!self.level_active)
+		return;
+
+	// anything left to read keeps the pin low, unless level mode got turned off
+	if (reg_is_bit_set(REG_ID_CF2, CF2_INT_LEVEL) && ((reg_get_value(REG_ID_INT) != 0) || (reg_get_value(REG_ID_GIN) != 0) || (fifo_count(FIFO_READER_I2C) > 0) || (events_count() > 0)))
+		return;
+
+	self.level_active = false;
+
+	if (!self.pulse_active)
+		gpio_put(PIN_INT, 1);
+}
+
 void interrupt_init(void)
 {
 	gpio_init(PIN_INT);
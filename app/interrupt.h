@@ -1,3 +1,6 @@
 #pragma once
 
+// level mode: let go of the pin once REG_ID_INT and REG_ID_GIN are clear and the FIFO is empty for the I2C host
+void interrupt_sync(void);
+
 void interrupt_init(void);
@@ -1,25 +1,51 @@
 #include "app_config.h"
+#include "debounce.h"
+#include "events.h"
 #include "fifo.h"
+#include "input_core.h"
 #include "keyboard.h"
+#include "keymap.h"
+#include "keymap_table.h"
 #include "reg.h"
 
+#include <hardware/sync.h>
 #include <pico/stdlib.h>
 
-#define LIST_SIZE	10 // size of the list keeping track of all the pressed keys
+#if KEY_SCAN_PIO
+#include "keyboard_matrix.pio.h"
 
-struct entry
-{
-	char chr;
-	char alt;
-	enum key_mod mod;
-};
+#include <hardware/clocks.h>
+#include <hardware/dma.h>
+#include <hardware/irq.h>
+#include <hardware/pio.h>
+#include <string.h>
+
+#define PIO_SCAN_SLOTS			(NUM_OF_COLS + 1) // one per column, then one releasing them all
+#define PIO_SCAN_CYCLES_PER_SLOT	41 // see keyboard_matrix.pio
+#define PIO_SCAN_IRQ_CHANGED		0  // raised by the state machine when a sample changed
+#endif
+
+#define SCAN_PERIOD_MIN_US	100 // 10kHz
+
+// the scan stats are updated from the scan, possibly on core1, and taken from core0. It's one of the
+// shared striped locks, which need no claiming, so it's usable before either core ran keyboard_init.
+#define STATS_LOCK			spin_lock_instance(PICO_SPINLOCK_ID_STRIPED_FIRST)
 
-struct list_item
+#define NUM_OF_MATRIX_KEYS	(NUM_OF_ROWS * NUM_OF_COLS)
+#define NUM_OF_KEYS			(NUM_OF_MATRIX_KEYS + NUM_OF_BTNS)
+#define KEY_IDX(r, c)		(((r) * NUM_OF_COLS) + (c)) // same order as kbd_entries
+#define ROW_BITS(m, r)		((uint32_t)((m) >> ((r) * NUM_OF_COLS)) & ((1u << NUM_OF_COLS) - 1))
+
+#define KEYMAP_CFG_MASK		(CFG_REPORT_MODS | CFG_USE_MODS) // config bits the keymap depends on
+
+_Static_assert(NUM_OF_KEYS <= 64, "Key bitmap is limited to 64 keys");
+_Static_assert(NUM_OF_KEYS == KEYMAP_NUM_KEYS, "Keymap has to cover every key");
+
+struct key_item
 {
-	const struct entry *p_entry;
+	const struct keymap_entry *p_entry;
 	uint32_t hold_start_time;
 	enum key_state state;
-	bool mods[KEY_MOD_ID_LAST];
 	char effective_key;
 };
 
@@ -36,7 +62,7 @@ static const uint8_t col_pins[NUM_OF_COLS] =
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
 
-static const struct entry kbd_entries[][NUM_OF_COLS] =
+static const struct keymap_entry kbd_entries[][NUM_OF_COLS] =
 {
 	{ { KEY_JOY_CENTER },  { 'W', '1' },              { 'G', '/' },              { 'S', '4' },              { 'L', '"'  },  { 'H' , ':' } },
 	{ { },                 { 'Q', '#' },              { 'R', '3' },              { 'E', '2' },              { 'O', '+'  },  { 'U', '_'  } },
@@ -48,7 +74,7 @@ static const struct entry kbd_entries[][NUM_OF_COLS] =
 };
 
 #if NUM_OF_BTNS > 0
-static const struct entry btn_entries[NUM_OF_BTNS] =
+static const struct keymap_entry btn_entries[NUM_OF_BTNS] =
 {
 	BTN_KEYS
 };
@@ -66,7 +92,12 @@ static struct
 	struct key_lock_callback *lock_callbacks;
 	struct key_callback *key_callbacks;
 
-	struct list_item list[LIST_SIZE];
+	struct key_item keys[NUM_OF_KEYS];
+
+	char keymap[KEYMAP_TABLE_LAYERS][NUM_OF_KEYS];
+	uint8_t keymap_cfg;
+	uint32_t keymap_version;
+	uint8_t layer;
 
 	bool mods[KEY_MOD_ID_LAST];
 
@@ -75,68 +106,218 @@ static struct
 
 	bool numlock_changed;
 	bool numlock;
+
+	uint64_t matrix;  // keys currently down, one bit per key
+	uint64_t pending; // keys that need a look in the next scan even without changing
+	uint64_t blocked; // keys held back because they could be ghosts
+
+	uint16_t scan_duration_max; // under STATS_LOCK
+	uint8_t ghost_count;        // under STATS_LOCK
+
+	bool tap_pending;
+	struct fifo_item tap; // press held back in case the release comes next
+
+	bool idle;
+	uint32_t last_active_time;
+	uint32_t wake_mask;
+
+#if KEY_SCAN_PIO
+	struct
+	{
+		PIO pio;
+		uint sm;
+		uint offset;
+		uint in_base;   // the lowest row or button pin, where the samples start
+		uint dma_tx;
+		uint dma_rx;
+		uint dma_tx_rearm;
+		uint dma_rx_rearm;
+		uint32_t period_us;
+		uint32_t col_mask;
+
+		// goes out to the state machine and comes back with the new samples, see keyboard_matrix.pio
+		struct
+		{
+			uint32_t col_mask;
+			uint32_t sample;
+		} frame[PIO_SCAN_SLOTS];
+
+		const void *frame_addr; // what the rearm channels load into the data channels
+	} scan;
+#endif
 } self;
 
-static void transition_to(struct list_item * const p_item, const enum key_state next_state)
+static void dispatch_lock_event(uint16_t caps_changed, uint16_t num_changed, uint32_t time)
 {
-	const struct entry * const p_entry = p_item->p_entry;
+	(void)time;
 
-	p_item->state = next_state;
+	struct key_lock_callback *cb = self.lock_callbacks;
+	while (cb) {
+		cb->func(caps_changed, num_changed);
 
-	if (!p_entry)
-		return;
+		cb = cb->next;
+	}
+}
 
-	if (p_item->effective_key == '\0') {
-		char key = p_entry->chr;
-		switch (p_entry->mod) {
-			case KEY_MOD_ID_ALT:
-				if (reg_is_bit_set(REG_ID_CFG, CFG_REPORT_MODS))
-					key = KEY_MOD_ALT;
-				break;
-
-			case KEY_MOD_ID_SHL:
-				if (reg_is_bit_set(REG_ID_CFG, CFG_REPORT_MODS))
-					key = KEY_MOD_SHL;
-				break;
-
-			case KEY_MOD_ID_SHR:
-				if (reg_is_bit_set(REG_ID_CFG, CFG_REPORT_MODS))
-					key = KEY_MOD_SHR;
-				break;
-
-			case KEY_MOD_ID_SYM:
-				if (reg_is_bit_set(REG_ID_CFG, CFG_REPORT_MODS))
-					key = KEY_MOD_SYM;
-				break;
-
-			default:
-			{
-				if (reg_is_bit_set(REG_ID_CFG, CFG_USE_MODS)) {
-					const bool shift = (self.mods[KEY_MOD_ID_SHL] || self.mods[KEY_MOD_ID_SHR]) | self.capslock;
-					const bool alt = self.mods[KEY_MOD_ID_ALT] | self.numlock;
-					const bool is_button = (key <= KEY_BTN_RIGHT1) || ((key >= KEY_BTN_LEFT2) && (key <= KEY_BTN_RIGHT2));
-
-					if (alt && !is_button) {
-						key = p_entry->alt;
-					} else if (!shift && (key >= 'A' && key <= 'Z')) {
-						key = (key + ' ');
-					}
-				}
+static void queue_event(const struct fifo_item item)
+{
+	const uint8_t full = fifo_enqueue(item, reg_is_bit_set(REG_ID_CFG, CFG_OVERFLOW_ON));
 
-				break;
-			}
+	// the interrupt is the I2C host's, the USB host finds out from REG_ID_KEY
+	if ((full & FIFO_READER_BIT(FIFO_READER_I2C)) && reg_is_bit_set(REG_ID_CFG, CFG_OVERFLOW_INT))
+		reg_set_bit(REG_ID_INT, INT_OVERFLOW);
+}
+
+// Compact mode: a press is held back until the next event, if that's the release of the same key
+// both go in the FIFO as a single tap. A held key gets its press out with the hold event. A press
+// whose release won't go to the same readers can't become a tap, so it goes in right away.
+static void queue_compact_event(const struct fifo_item item, const bool tap_possible)
+{
+	if (self.tap_pending) {
+		self.tap_pending = false;
+
+		if ((item.state == KEY_STATE_RELEASED) && (item.key == self.tap.key) && (item.readers == self.tap.readers)) {
+			self.tap.state = KEY_STATE_TAP;
+			queue_event(self.tap);
+			return;
 		}
 
-		p_item->effective_key = key;
+		queue_event(self.tap);
+	}
+
+	if ((item.state == KEY_STATE_PRESSED) && tap_possible) {
+		self.tap = item;
+		self.tap_pending = true;
+		return;
+	}
+
+	queue_event(item);
+}
+
+static void fifo_queue(const struct fifo_item item, const bool tap_possible)
+{
+	if (reg_is_bit_set(REG_ID_CF2, CF2_COMPACT_EVENTS)) {
+		queue_compact_event(item, tap_possible);
+		return;
+	}
+
+	// compact mode got turned off with a press held back
+	if (self.tap_pending) {
+		self.tap_pending = false;
+		queue_event(self.tap);
+	}
+
+	queue_event(item);
+}
+
+// the state and the source travel together through input_core_defer
+#define EVENT_STATE_SOURCE(st, src)	((uint8_t)(((src) << 4) | (st)))
+#define EVENT_STATE(ss)				((enum key_state)((ss) & 0x0F))
+#define EVENT_SOURCE(ss)			((enum key_source)((ss) >> 4))
+
+static bool event_filter_match(const uint8_t filter_reg, const uint8_t key, const enum key_state state, const enum key_source source)
+{
+	if (filter_reg == REG_ID_INVALID)
+		return true;
+
+	const uint8_t keys = reg_get_value(filter_reg);
+	const uint8_t sources = reg_get_value(filter_reg + 1);
+
+	uint8_t key_class = FLT_PRINTABLE;
+	if ((key >= KEY_MOD_ALT) && (key <= KEY_MOD_SYM))
+		key_class = FLT_MODS;
+	else if (((key >= KEY_JOY_UP) && (key <= KEY_BTN_RIGHT1)) || ((key >= KEY_BTN_LEFT2) && (key <= KEY_BTN_RIGHT2)))
+		key_class = FLT_NAV;
+
+	const uint8_t state_bit = (state == KEY_STATE_PRESSED) ? FLT_PRESSED : (state == KEY_STATE_HOLD) ? FLT_HOLD : FLT_RELEASED;
+
+	return (keys & state_bit) && (keys & key_class) && (sources & (1 << source));
+}
+
+// the I2C and USB vendor hosts share the FIFO, each one only gets what it wants
+static uint8_t event_readers(const uint8_t key, const enum key_state state, const enum key_source source)
+{
+	uint8_t readers = 0;
+
+	if (event_filter_match(REG_ID_FIK, key, state, source))
+		readers |= FIFO_READER_BIT(FIFO_READER_I2C);
+
+	if (event_filter_match(REG_ID_FVK, key, state, source))
+		readers |= FIFO_READER_BIT(FIFO_READER_USB);
+
+	return readers;
+}
+
+static void dispatch_key_event(uint16_t key, uint16_t state_source, uint32_t time)
+{
+	const enum key_state state = EVENT_STATE(state_source);
+	const enum key_source source = EVENT_SOURCE(state_source);
+	const struct fifo_item item = { (char)key, state, time, event_readers(key, state, source) };
+
+	if (item.readers) {
+		fifo_queue(item, event_readers(key, KEY_STATE_RELEASED, source) == item.readers);
+		events_push(EVT_KEY, state, key, source);
+	} else if (self.tap_pending && (item.key == self.tap.key)) {
+		// the hold or release of the press held back in compact mode got filtered out, with
+		// nothing coming after it the press would sit there until the next key
+		self.tap_pending = false;
+		queue_event(self.tap);
+	}
+
+	struct key_callback *cb = self.key_callbacks;
+	while (cb) {
+		if (event_filter_match(cb->filter_reg, key, state, source))
+			cb->func(key, state);
+
+		cb = cb->next;
+	}
+}
+
+static const struct keymap_entry *key_entry(uint32_t key_idx);
+
+// precompute the key reported for every key on every layer, only needed when the config or keymap changes
+static void keymap_build(const uint8_t cfg)
+{
+	self.keymap_version = keymap_get_version();
+
+	keymap_table_build(self.keymap, cfg, key_entry);
+
+	self.keymap_cfg = cfg;
+}
+
+static void keymap_fill_defaults(void)
+{
+	keymap_table_fill_defaults(key_entry);
+}
+
+static void update_layer(void)
+{
+	const bool shift = (self.mods[KEY_MOD_ID_SHL] || self.mods[KEY_MOD_ID_SHR]) | self.capslock;
+	const bool alt = self.mods[KEY_MOD_ID_ALT] | self.numlock;
+	const bool sym = self.mods[KEY_MOD_ID_SYM];
+
+	self.layer = (shift ? KEYMAP_TABLE_SHIFT : 0) | (alt ? KEYMAP_TABLE_ALT : 0) | (sym ? KEYMAP_TABLE_SYM : 0);
+}
+
+static void transition_to(struct key_item * const p_item, const enum key_state next_state)
+{
+	p_item->state = next_state;
+
+	if (p_item->effective_key == '\0') {
+		const uint8_t cfg = (reg_get_value(REG_ID_CFG) & KEYMAP_CFG_MASK);
+		if ((cfg != self.keymap_cfg) || (keymap_get_version() != self.keymap_version))
+			keymap_build(cfg);
+
+		p_item->effective_key = self.keymap[self.layer][p_item - self.keys];
 	}
 
 	if (p_item->effective_key == '\0')
 		return;
 
-	keyboard_inject_event(p_item->effective_key, next_state);
+	keyboard_inject_event(p_item->effective_key, next_state, KEY_SOURCE_KEYBOARD);
 }
 
-static void next_item_state(struct list_item * const p_item, const bool pressed)
+static void next_item_state(struct key_item * const p_item, const bool pressed)
 {
 	switch (p_item->state) {
 		case KEY_STATE_IDLE:
@@ -169,14 +350,10 @@ static void next_item_state(struct list_item * const p_item, const bool pressed)
 					self.numlock_changed = false;
 				}
 
-				if (self.lock_callbacks && (self.capslock_changed || self.numlock_changed)) {
-					struct key_lock_callback *cb = self.lock_callbacks;
-					while (cb) {
-						cb->func(self.capslock_changed, self.numlock_changed);
+				if (self.capslock_changed || self.numlock_changed)
+					input_core_defer(dispatch_lock_event, self.capslock_changed, self.numlock_changed);
 
-						cb = cb->next;
-					}
-				}
+				update_layer();
 
 				transition_to(p_item, KEY_STATE_PRESSED);
 
@@ -199,131 +376,550 @@ static void next_item_state(struct list_item * const p_item, const bool pressed)
 
 		case KEY_STATE_RELEASED:
 		{
-			if (p_item->p_entry->mod != KEY_MOD_ID_NONE)
+			if (p_item->p_entry->mod != KEY_MOD_ID_NONE) {
 				self.mods[p_item->p_entry->mod] = false;
+				update_layer();
+			}
 
-			p_item->p_entry = NULL;
+			// back to idle quietly, there's no event for that
 			p_item->effective_key = '\0';
-			transition_to(p_item, KEY_STATE_IDLE);
+			p_item->state = KEY_STATE_IDLE;
 			break;
 		}
+
+		case KEY_STATE_TAP: // FIFO only
+			break;
 	}
 }
 
-static int64_t timer_task(alarm_id_t id, void *user_data)
+static const struct keymap_entry *key_entry(uint32_t key_idx)
 {
-	(void)id;
-	(void)user_data;
+#if NUM_OF_BTNS > 0
+	if (key_idx >= NUM_OF_MATRIX_KEYS)
+		return &btn_entries[key_idx - NUM_OF_MATRIX_KEYS];
+#endif
 
-	for (uint32_t c = 0; c < NUM_OF_COLS; ++c) {
-		gpio_pull_up(col_pins[c]);
-		gpio_put(col_pins[c], 0);
-		gpio_set_dir(col_pins[c], GPIO_OUT);
+	return &((const struct keymap_entry*)kbd_entries)[key_idx];
+}
 
-		for (uint32_t r = 0; r < NUM_OF_ROWS; ++r) {
-			const bool pressed = (gpio_get(row_pins[r]) == 0);
-			const int32_t key_idx = (int32_t)((r * NUM_OF_COLS) + c);
+// returns true if the key has to be looked at in the next scan, even if its state doesn't change
+static bool scan_key(const uint32_t key_idx, const bool pressed)
+{
+	struct key_item * const p_item = &self.keys[key_idx];
 
-			int32_t list_idx = -1;
-			for (int32_t i = 0; i < LIST_SIZE; ++i) {
-				if (self.list[i].p_entry != &((const struct entry*)kbd_entries)[key_idx])
-					continue;
+	next_item_state(p_item, pressed);
 
-				list_idx = i;
-				break;
-			}
+	// waiting for the hold timeout, or for the release to go back to idle
+	return (p_item->state == KEY_STATE_PRESSED) || (p_item->state == KEY_STATE_RELEASED);
+}
 
-			if (list_idx > -1) {
-				next_item_state(&self.list[list_idx], pressed);
-				continue;
-			}
+// Without diodes, three keys down on the corners of a rectangle make the fourth corner look
+// pressed too. Keys on such a rectangle that weren't already down can't be trusted, so they
+// are held back until the rectangle goes away.
+static uint64_t ghost_filter(const uint64_t matrix)
+{
+	uint64_t ambiguous = 0;
 
-			if (!pressed)
+	for (uint32_t r1 = 0; r1 < (NUM_OF_ROWS - 1); ++r1) {
+		const uint32_t row1 = ROW_BITS(matrix, r1);
+
+		// needs at least two keys in the row
+		if (!(row1 & (row1 - 1)))
+			continue;
+
+		for (uint32_t r2 = (r1 + 1); r2 < NUM_OF_ROWS; ++r2) {
+			const uint64_t common = (row1 & ROW_BITS(matrix, r2));
+
+			if (!(common & (common - 1)))
 				continue;
 
-			for (uint32_t i = 0 ; i < LIST_SIZE; ++i) {
-				if (self.list[i].p_entry != NULL)
-					continue;
+			ambiguous |= (common << KEY_IDX(r1, 0)) | (common << KEY_IDX(r2, 0));
+		}
+	}
 
-				self.list[i].p_entry = &((const struct entry*)kbd_entries)[key_idx];
-				self.list[i].effective_key = '\0';
-				self.list[i].state = KEY_STATE_IDLE;
-				next_item_state(&self.list[i], pressed);
+	const uint64_t blocked = (ambiguous & ~self.matrix);
 
-				break;
-			}
+	const uint32_t newly_blocked = __builtin_popcountll(blocked & ~self.blocked);
+	if (newly_blocked) {
+		const uint32_t irq_state = spin_lock_blocking(STATS_LOCK);
+
+		self.ghost_count = MIN(UINT8_MAX, self.ghost_count + newly_blocked);
+
+		spin_unlock(STATS_LOCK, irq_state);
+	}
+
+	self.blocked = blocked;
+
+	return (matrix & ~blocked);
+}
+
+static uint32_t scan_period_us(void)
+{
+	const uint32_t period_us = reg_get_scan_period();
+
+	// the us period takes precedence, the ms one is there for backwards compatibility
+	if (period_us == 0)
+		return MAX(reg_get_value(REG_ID_FRQ) * 1000, SCAN_PERIOD_MIN_US);
+
+	return MAX(period_us, SCAN_PERIOD_MIN_US);
+}
+
+static void record_scan_duration(const uint32_t start_time)
+{
+	const uint32_t duration = MIN(time_us_32() - start_time, UINT16_MAX);
+
+	const uint32_t irq_state = spin_lock_blocking(STATS_LOCK);
+
+	if (duration > self.scan_duration_max)
+		self.scan_duration_max = duration;
+
+	spin_unlock(STATS_LOCK, irq_state);
+}
+
+static void scan_matrix(const uint64_t raw)
+{
+	const uint64_t matrix = ghost_filter(debounce_update(raw, scan_period_us()));
+
+	uint64_t work = (matrix ^ self.matrix) | self.pending;
+
+	self.matrix = matrix;
+
+	while (work) {
+		const uint32_t key_idx = __builtin_ctzll(work);
+		const uint64_t key_bit = (1ull << key_idx);
+
+		work &= ~key_bit;
+
+		if (scan_key(key_idx, (matrix & key_bit) != 0))
+			self.pending |= key_bit;
+		else
+			self.pending &= ~key_bit;
+	}
+}
+
+// turn the whole-bank GPIO samples taken with each column driven into a bitmap of pressed keys
+static uint64_t matrix_from_samples(const uint32_t samples[NUM_OF_COLS])
+{
+	uint64_t matrix = 0;
+
+	for (uint32_t c = 0; c < NUM_OF_COLS; ++c) {
+		const uint32_t low = ~samples[c];
+
+		for (uint32_t r = 0; r < NUM_OF_ROWS; ++r) {
+			if (low & (1u << row_pins[r]))
+				matrix |= (1ull << KEY_IDX(r, c));
 		}
+	}
 
-		gpio_put(col_pins[c], 1);
-		gpio_disable_pulls(col_pins[c]);
+#if NUM_OF_BTNS > 0
+	for (uint32_t b = 0; b < NUM_OF_BTNS; ++b) {
+		if (~samples[0] & (1u << btn_pins[b]))
+			matrix |= (1ull << (NUM_OF_MATRIX_KEYS + b));
+	}
+#endif
+
+	return matrix;
+}
+
+#if KEY_SCAN_PIO
+static void pio_scan_set_rate(uint32_t period_us)
+{
+	self.scan.period_us = period_us;
+
+	// one full frame per scan period, as slow as the divider allows
+	const uint32_t div = ((clock_get_hz(clk_sys) / 1000000) * period_us) / (PIO_SCAN_SLOTS * PIO_SCAN_CYCLES_PER_SLOT);
+
+	pio_sm_set_clkdiv_int_frac(self.scan.pio, self.scan.sm, MAX(1, MIN(div, UINT16_MAX)), 0);
+}
+
+// Frame irq while something waits on time (debounce, hold, idle), otherwise the frames go on
+// without the CPU and only a changed sample raises an irq, which turns the frame irq back on.
+static void pio_scan_set_frame_irq(bool enabled)
+{
+	// a frame that already ended doesn't count, the change may have come in after it
+	if (enabled)
+		dma_channel_acknowledge_irq0(self.scan.dma_rx);
+
+	dma_channel_set_irq0_enabled(self.scan.dma_rx, enabled);
+	pio_set_irq0_source_enabled(self.scan.pio, pis_interrupt0 + PIO_SCAN_IRQ_CHANGED, !enabled);
+}
+
+static void pio_scan_start(void)
+{
+	// from the first slot, with nothing left over from before
+	pio_sm_clear_fifos(self.scan.pio, self.scan.sm);
+	pio_sm_restart(self.scan.pio, self.scan.sm);
+	pio_sm_exec(self.scan.pio, self.scan.sm, pio_encode_jmp(self.scan.offset));
+
+	dma_channel_transfer_to_buffer_now(self.scan.dma_rx, self.scan.frame, PIO_SCAN_SLOTS * 2);
+	dma_channel_transfer_from_buffer_now(self.scan.dma_tx, self.scan.frame, PIO_SCAN_SLOTS * 2);
+
+	pio_sm_set_enabled(self.scan.pio, self.scan.sm, true);
+}
+
+// a data channel finishing gets it started again by its rearm channel, abort until both are down
+static void pio_scan_abort_dma(uint data, uint rearm)
+{
+	while (dma_channel_is_busy(data) || dma_channel_is_busy(rearm)) {
+		dma_channel_abort(rearm);
+		dma_channel_abort(data);
+	}
+}
+
+static void scan_park(void)
+{
+	dma_channel_set_irq0_enabled(self.scan.dma_rx, false);
+	pio_set_irq0_source_enabled(self.scan.pio, pis_interrupt0 + PIO_SCAN_IRQ_CHANGED, false);
+
+	// with the state machine stopped the DMA stalls on the FIFOs
+	pio_sm_set_enabled(self.scan.pio, self.scan.sm, false);
+
+	pio_scan_abort_dma(self.scan.dma_tx, self.scan.dma_tx_rearm);
+	pio_scan_abort_dma(self.scan.dma_rx, self.scan.dma_rx_rearm);
+
+	pio_interrupt_clear(self.scan.pio, PIO_SCAN_IRQ_CHANGED);
+
+	pio_sm_set_pindirs_with_mask(self.scan.pio, self.scan.sm, self.scan.col_mask, self.scan.col_mask);
+}
+
+static void scan_resume(void)
+{
+	pio_sm_set_pindirs_with_mask(self.scan.pio, self.scan.sm, 0, self.scan.col_mask);
+
+	if (scan_period_us() != self.scan.period_us)
+		pio_scan_set_rate(scan_period_us());
+
+	// the key that woke us up may not show up as a change, look at the frames until idle again
+	pio_scan_set_frame_irq(true);
+
+	pio_scan_start();
+}
+#else
+static int64_t timer_task(alarm_id_t id, void *user_data);
+
+static void scan_park(void)
+{
+	for (uint32_t c = 0; c < NUM_OF_COLS; ++c) {
+		gpio_put(col_pins[c], 0);
+		gpio_set_dir(col_pins[c], GPIO_OUT);
+	}
+}
+
+static void scan_resume(void)
+{
+	for (uint32_t c = 0; c < NUM_OF_COLS; ++c)
 		gpio_set_dir(col_pins[c], GPIO_IN);
+
+	alarm_pool_add_alarm_in_us(input_core_get_alarm_pool(), 0, timer_task, NULL, true);
+}
+#endif
+
+static void set_wake_irqs_enabled(bool enabled)
+{
+	for (uint32_t r = 0; r < NUM_OF_ROWS; ++r) {
+		if (enabled)
+			gpio_acknowledge_irq(row_pins[r], GPIO_IRQ_EDGE_FALL);
+
+		gpio_set_irq_enabled(row_pins[r], GPIO_IRQ_EDGE_FALL, enabled);
 	}
 
 #if NUM_OF_BTNS > 0
 	for (uint32_t b = 0; b < NUM_OF_BTNS; ++b) {
-		const bool pressed = (gpio_get(btn_pins[b]) == 0);
+		if (enabled)
+			gpio_acknowledge_irq(btn_pins[b], GPIO_IRQ_EDGE_FALL);
 
-		int32_t list_idx = -1;
-		for (int32_t i = 0; i < LIST_SIZE; ++i) {
-			if (self.list[i].p_entry != &((const struct entry*)btn_entries)[b])
-				continue;
+		gpio_set_irq_enabled(btn_pins[b], GPIO_IRQ_EDGE_FALL, enabled);
+	}
+#endif
+}
 
-			list_idx = i;
-			break;
-		}
+static void idle_exit(void)
+{
+	set_wake_irqs_enabled(false);
 
-		if (list_idx > -1) {
-			next_item_state(&self.list[list_idx], pressed);
-			continue;
-		}
+	self.idle = false;
+	self.last_active_time = to_ms_since_boot(get_absolute_time());
 
-		if (!pressed)
-			continue;
+	scan_resume();
+}
 
-		for (uint32_t i = 0 ; i < LIST_SIZE; ++i) {
-			if (self.list[i].p_entry != NULL)
-				continue;
+static void idle_enter(void)
+{
+	self.idle = true;
 
-			self.list[i].p_entry = &((const struct entry*)btn_entries)[b];
-			self.list[i].effective_key = '\0';
-			self.list[i].state = KEY_STATE_IDLE;
-			next_item_state(&self.list[i], pressed);
+	// all columns low, so any key press pulls its row low and wakes us up
+	scan_park();
+	set_wake_irqs_enabled(true);
 
-			break;
-		}
+	// a key that went down after the last scan won't generate an edge anymore
+	if ((gpio_get_all() & self.wake_mask) != self.wake_mask)
+		idle_exit();
+}
+
+static bool is_idle_time(void)
+{
+	const uint32_t now = to_ms_since_boot(get_absolute_time());
+
+	if (self.matrix || self.pending || self.blocked || debounce_is_busy()) {
+		self.last_active_time = now;
+		return false;
 	}
-#endif
 
-	// negative value means interval since last alarm time
-	return -(reg_get_value(REG_ID_FRQ) * 1000);
+	// 0 disables the idle mode
+	if (reg_get_value(REG_ID_IDL) == 0)
+		return false;
+
+	return ((now - self.last_active_time) > (reg_get_value(REG_ID_IDL) * 10));
 }
 
-void keyboard_inject_event(char key, enum key_state state)
+#if KEY_SCAN_PIO
+// nothing depends on time passing, only a change can make a difference
+static bool pio_scan_is_steady(void)
 {
-	const struct fifo_item item = { key, state };
-	if (!fifo_enqueue(item)) {
-		if (reg_is_bit_set(REG_ID_CFG, CFG_OVERFLOW_INT))
-			reg_set_bit(REG_ID_INT, INT_OVERFLOW);
+	if (self.pending || debounce_is_busy())
+		return false;
 
-		if (reg_is_bit_set(REG_ID_CFG, CFG_OVERFLOW_ON))
-			fifo_enqueue_force(item);
+	// counting down to idle, unless a key is down or idle mode is off
+	return (self.matrix || self.blocked || (reg_get_value(REG_ID_IDL) == 0));
+}
+
+static void pio_scan_frame_irq(void)
+{
+	const uint32_t start_time = time_us_32();
+
+	dma_channel_acknowledge_irq0(self.scan.dma_rx);
+
+	// came in right before parking
+	if (self.idle)
+		return;
+
+	if (scan_period_us() != self.scan.period_us)
+		pio_scan_set_rate(scan_period_us());
+
+	uint32_t samples[NUM_OF_COLS];
+	for (uint32_t c = 0; c < NUM_OF_COLS; ++c)
+		samples[c] = (self.scan.frame[c].sample << self.scan.in_base);
+
+	scan_matrix(matrix_from_samples(samples));
+
+	record_scan_duration(start_time);
+
+	if (is_idle_time()) {
+		idle_enter();
+		return;
 	}
 
-	struct key_callback *cb = self.key_callbacks;
-	while (cb) {
-		cb->func(key, state);
+	if (pio_scan_is_steady())
+		pio_scan_set_frame_irq(false);
+}
 
-		cb = cb->next;
+static void pio_scan_change_irq(void)
+{
+	pio_interrupt_clear(self.scan.pio, PIO_SCAN_IRQ_CHANGED);
+
+	if (self.idle)
+		return;
+
+	// the frame isn't complete yet, it gets a look once it is
+	pio_scan_set_frame_irq(true);
+}
+
+// starts the data channel over from the start of the frame once it's done
+static uint pio_scan_claim_rearm(volatile void *trigger_reg)
+{
+	const uint channel = dma_claim_unused_channel(true);
+
+	dma_channel_config config = dma_channel_get_default_config(channel);
+	channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+	channel_config_set_read_increment(&config, false);
+	channel_config_set_write_increment(&config, false);
+	dma_channel_configure(channel, &config, trigger_reg, &self.scan.frame_addr, 1, false);
+
+	return channel;
+}
+
+static void pio_scan_init(void)
+{
+	PIO pio = pio0;
+
+	self.scan.pio = pio;
+	self.scan.sm = pio_claim_unused_sm(pio, true);
+
+	// only the rows and buttons get sampled, so nothing else on the bank can make a change
+	uint in_top = 0;
+	self.scan.in_base = NUM_BANK0_GPIOS;
+
+	for (uint32_t r = 0; r < NUM_OF_ROWS; ++r) {
+		self.scan.in_base = MIN(self.scan.in_base, row_pins[r]);
+		in_top = MAX(in_top, row_pins[r]);
 	}
+
+#if NUM_OF_BTNS > 0
+	for (uint32_t b = 0; b < NUM_OF_BTNS; ++b) {
+		self.scan.in_base = MIN(self.scan.in_base, btn_pins[b]);
+		in_top = MAX(in_top, btn_pins[b]);
+	}
+#endif
+
+	uint16_t instructions[PIO_INSTRUCTION_COUNT];
+	memcpy(instructions, keyboard_matrix_program.instructions, keyboard_matrix_program.length * sizeof(uint16_t));
+	instructions[keyboard_matrix_offset_sample] = pio_encode_in(pio_pins, (in_top - self.scan.in_base) + 1);
+
+	struct pio_program program = keyboard_matrix_program;
+	program.instructions = instructions;
+
+	self.scan.offset = pio_add_program(pio, &program);
+
+	// the columns are open-drain, their value stays 0 and only the direction gets toggled
+	for (uint32_t c = 0; c < NUM_OF_COLS; ++c) {
+		self.scan.frame[c].col_mask = (1u << col_pins[c]);
+		self.scan.col_mask |= self.scan.frame[c].col_mask;
+
+		pio_gpio_init(pio, col_pins[c]);
+	}
+
+	// the last slot drives nothing
+	self.scan.frame[NUM_OF_COLS].col_mask = 0;
+
+	pio_sm_set_pins_with_mask(pio, self.scan.sm, 0, self.scan.col_mask);
+	pio_sm_set_pindirs_with_mask(pio, self.scan.sm, 0, self.scan.col_mask);
+
+	pio_sm_config config = keyboard_matrix_program_get_default_config(self.scan.offset);
+	sm_config_set_out_pins(&config, 0, 32);
+	sm_config_set_in_pins(&config, self.scan.in_base);
+	sm_config_set_out_shift(&config, true, true, 32);
+	sm_config_set_in_shift(&config, false, false, 32);
+	pio_sm_init(pio, self.scan.sm, self.scan.offset, &config);
+
+	self.scan.frame_addr = self.scan.frame;
+
+	// the frame goes in, column masks and previous samples
+	self.scan.dma_tx = dma_claim_unused_channel(true);
+	self.scan.dma_tx_rearm = pio_scan_claim_rearm(&dma_hw->ch[self.scan.dma_tx].al3_read_addr_trig);
+	dma_channel_config tx_config = dma_channel_get_default_config(self.scan.dma_tx);
+	channel_config_set_transfer_data_size(&tx_config, DMA_SIZE_32);
+	channel_config_set_read_increment(&tx_config, true);
+	channel_config_set_write_increment(&tx_config, false);
+	channel_config_set_dreq(&tx_config, pio_get_dreq(pio, self.scan.sm, true));
+	channel_config_set_chain_to(&tx_config, self.scan.dma_tx_rearm);
+	dma_channel_configure(self.scan.dma_tx, &tx_config, &pio->txf[self.scan.sm], self.scan.frame, PIO_SCAN_SLOTS * 2, false);
+
+	// and comes back out with the new samples
+	self.scan.dma_rx = dma_claim_unused_channel(true);
+	self.scan.dma_rx_rearm = pio_scan_claim_rearm(&dma_hw->ch[self.scan.dma_rx].al2_write_addr_trig);
+	dma_channel_config rx_config = dma_channel_get_default_config(self.scan.dma_rx);
+	channel_config_set_transfer_data_size(&rx_config, DMA_SIZE_32);
+	channel_config_set_read_increment(&rx_config, false);
+	channel_config_set_write_increment(&rx_config, true);
+	channel_config_set_dreq(&rx_config, pio_get_dreq(pio, self.scan.sm, false));
+	channel_config_set_chain_to(&rx_config, self.scan.dma_rx_rearm);
+	dma_channel_configure(self.scan.dma_rx, &rx_config, self.scan.frame, &pio->rxf[self.scan.sm], PIO_SCAN_SLOTS * 2, false);
+
+	// irq once the whole frame has been sampled
+	irq_set_exclusive_handler(DMA_IRQ_0, pio_scan_frame_irq);
+	irq_set_enabled(DMA_IRQ_0, true);
+
+	// or once a sample changed
+	irq_set_exclusive_handler(PIO0_IRQ_0, pio_scan_change_irq);
+	irq_set_enabled(PIO0_IRQ_0, true);
+
+	pio_scan_set_rate(scan_period_us());
+	pio_scan_set_frame_irq(true);
+
+	pio_scan_start();
 }
+#else
+static int64_t timer_task(alarm_id_t id, void *user_data)
+{
+	(void)id;
+	(void)user_data;
 
-bool keyboard_is_key_down(char key)
+	const uint32_t start_time = time_us_32();
+
+	uint32_t samples[NUM_OF_COLS];
+
+	for (uint32_t c = 0; c < NUM_OF_COLS; ++c) {
+		gpio_pull_up(col_pins[c]);
+		gpio_put(col_pins[c], 0);
+		gpio_set_dir(col_pins[c], GPIO_OUT);
+
+		samples[c] = gpio_get_all();
+
+		gpio_put(col_pins[c], 1);
+		gpio_disable_pulls(col_pins[c]);
+		gpio_set_dir(col_pins[c], GPIO_IN);
+	}
+
+	scan_matrix(matrix_from_samples(samples));
+
+	record_scan_duration(start_time);
+
+	if (is_idle_time()) {
+		idle_enter();
+		return 0;
+	}
+
+	// negative value means interval since last alarm time
+	return -(int64_t)scan_period_us();
+}
+#endif
+
+void keyboard_gpio_irq(uint gpio, uint32_t events)
 {
-	for (int32_t i = 0; i < LIST_SIZE; ++i) {
-		struct list_item *item = &self.list[i];
+	if (!self.idle)
+		return;
 
-		if (item->p_entry == NULL)
-			continue;
+	if (!(events & GPIO_IRQ_EDGE_FALL))
+		return;
+
+	if (!(self.wake_mask & (1u << gpio)))
+		return;
+
+	idle_exit();
+}
+
+void keyboard_inject_event(char key, enum key_state state, enum key_source source)
+{
+	input_core_defer(dispatch_key_event, key, EVENT_STATE_SOURCE(state, source));
+}
+
+uint16_t keyboard_take_scan_duration(void)
+{
+	const uint32_t irq_state = spin_lock_blocking(STATS_LOCK);
+
+	const uint16_t duration = self.scan_duration_max;
+	self.scan_duration_max = 0;
+
+	spin_unlock(STATS_LOCK, irq_state);
+
+	return duration;
+}
+
+void keyboard_sync_scan(void)
+{
+#if KEY_SCAN_PIO
+	// while steady the frames go on without the CPU, fake a change to have the frame irq back
+	if (self.scan.pio)
+		self.scan.pio->irq_force = (1u << PIO_SCAN_IRQ_CHANGED);
+#endif
+}
+
+uint8_t keyboard_take_ghost_count(void)
+{
+	const uint32_t irq_state = spin_lock_blocking(STATS_LOCK);
+
+	const uint8_t count = self.ghost_count;
+	self.ghost_count = 0;
+
+	spin_unlock(STATS_LOCK, irq_state);
+
+	return count;
+}
+
+bool keyboard_is_key_down(char key)
+{
+	for (int32_t i = 0; i < NUM_OF_KEYS; ++i) {
+		struct key_item *item = &self.keys[i];
 
 		if ((item->state != KEY_STATE_PRESSED) && (item->state != KEY_STATE_HOLD))
 			continue;
@@ -389,11 +985,20 @@ void keyboard_init(void)
 	for (int i = 0; i < KEY_MOD_ID_LAST; ++i)
 		self.mods[i] = false;
 
+	for (uint32_t i = 0; i < NUM_OF_KEYS; ++i)
+		self.keys[i].p_entry = key_entry(i);
+
+	keymap_init(keymap_fill_defaults);
+
+	keymap_build(reg_get_value(REG_ID_CFG) & KEYMAP_CFG_MASK);
+
 	// rows
 	for (uint32_t i = 0; i < NUM_OF_ROWS; ++i) {
 		gpio_init(row_pins[i]);
 		gpio_pull_up(row_pins[i]);
 		gpio_set_dir(row_pins[i], GPIO_IN);
+
+		self.wake_mask |= (1u << row_pins[i]);
 	}
 
 	// cols
@@ -408,8 +1013,16 @@ void keyboard_init(void)
 		gpio_init(btn_pins[i]);
 		gpio_pull_up(btn_pins[i]);
 		gpio_set_dir(btn_pins[i], GPIO_IN);
+
+		self.wake_mask |= (1u << btn_pins[i]);
 	}
 #endif
 
-	add_alarm_in_ms(reg_get_value(REG_ID_FRQ), timer_task, NULL, true);
+	self.last_active_time = to_ms_since_boot(get_absolute_time());
+
+#if KEY_SCAN_PIO
+	pio_scan_init();
+#else
+	alarm_pool_add_alarm_in_us(input_core_get_alarm_pool(), scan_period_us(), timer_task, NULL, true);
+#endif
 }
@@ -2,6 +2,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 enum key_state
 {
@@ -9,6 +10,16 @@ enum key_state
 	KEY_STATE_PRESSED,
 	KEY_STATE_HOLD,
 	KEY_STATE_RELEASED,
+	KEY_STATE_TAP, // pressed and released, only ever found in the FIFO
+};
+
+enum key_source
+{
+	KEY_SOURCE_KEYBOARD = 0,
+	KEY_SOURCE_SWIPE,
+	KEY_SOURCE_GPIO,
+
+	KEY_SOURCE_LAST,
 };
 
 enum key_mod
@@ -45,6 +56,7 @@ struct key_callback
 {
 	void (*func)(char, enum key_state);
 	struct key_callback *next;
+	uint8_t filter_reg; // first of the consumer's event filter registers, none means all events
 };
 
 struct key_lock_callback
@@ -53,7 +65,18 @@ struct key_lock_callback
 	struct key_lock_callback *next;
 };
 
-void keyboard_inject_event(char key, enum key_state state);
+void keyboard_gpio_irq(uint gpio, uint32_t events);
+
+void keyboard_inject_event(char key, enum key_state state, enum key_source source);
+
+// the scan period or the idle timeout changed
+void keyboard_sync_scan(void);
+
+// longest time a key matrix scan took since the last call, in us
+uint16_t keyboard_take_scan_duration(void);
+
+// number of key presses held back as possible ghosts since the last call, saturates at 255
+uint8_t keyboard_take_ghost_count(void);
 
 bool keyboard_is_key_down(char key);
 bool keyboard_is_mod_on(enum key_mod mod);
@@ -0,0 +1,255 @@
+#include "keymap.h"
+
+#include "input_core.h"
+#include "reg.h"
+
+#include <hardware/flash.h>
+#include <hardware/sync.h>
+#include <pico/stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifndef PICO_FLASH_SIZE_BYTES
+#define PICO_FLASH_SIZE_BYTES	(2 * 1024 * 1024) // same default as the SDK linker script
+#endif
+
+// the keymap lives in the last sector, well clear of the firmware
+#define FLASH_OFFSET			(PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+#define FLASH_MAGIC				0x4B4D4150 // "KMAP"
+
+struct keymap_flash
+{
+	uint32_t magic;
+	uint8_t num_layers;
+	uint8_t num_keys;
+	uint8_t base_layer;
+	uint8_t reserved;
+	uint8_t keys[KEYMAP_LAYER_LAST][KEYMAP_NUM_KEYS];
+	uint32_t checksum;
+};
+
+// flash gets programmed a page at a time
+#define FLASH_IMAGE_SIZE		(((sizeof(struct keymap_flash) + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE) * FLASH_PAGE_SIZE)
+
+_Static_assert(KEYMAP_NUM_KEYS <= UINT8_MAX, "Key index has to fit REG_ID_KMK");
+
+static struct
+{
+	uint8_t keys[KEYMAP_LAYER_LAST][KEYMAP_NUM_KEYS];
+	uint8_t base_layer;
+	uint32_t version;
+
+	volatile bool save_requested;
+	bool flash_valid;
+
+	void (*fill_defaults)(void);
+} self;
+
+static const struct keymap_flash *flash_keymap(void)
+{
+	return (const struct keymap_flash *)(XIP_BASE + FLASH_OFFSET);
+}
+
+// FNV-1a, over everything but the checksum itself
+static uint32_t flash_checksum(const struct keymap_flash *image)
+{
+	const uint8_t *data = (const uint8_t *)image;
+	uint32_t hash = 2166136261u;
+
+	for (size_t i = 0; i < offsetof(struct keymap_flash, checksum); ++i)
+		hash = (hash ^ data[i]) * 16777619u;
+
+	return hash;
+}
+
+static bool is_valid_key(uint8_t key)
+{
+	return (key <= KEYMAP_KEY_MAX) || (key == KEYMAP_KEY_TRNS);
+}
+
+static bool flash_is_valid(const struct keymap_flash *image)
+{
+	if (image->magic != FLASH_MAGIC)
+		return false;
+
+	// a firmware for a different board or with more layers can't use it
+	if ((image->num_layers != KEYMAP_LAYER_LAST) || (image->num_keys != KEYMAP_NUM_KEYS))
+		return false;
+
+	if (image->checksum != flash_checksum(image))
+		return false;
+
+	// saved before the key codes were limited
+	for (uint32_t layer = 0; layer < KEYMAP_LAYER_LAST; ++layer) {
+		for (uint32_t i = 0; i < KEYMAP_NUM_KEYS; ++i) {
+			if (!is_valid_key(image->keys[layer][i]))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static void flash_load(void)
+{
+	const struct keymap_flash *image = flash_keymap();
+
+	self.flash_valid = flash_is_valid(image);
+	if (!self.flash_valid)
+		return;
+
+	memcpy(self.keys, image->keys, sizeof(self.keys));
+	keymap_set_base_layer(image->base_layer);
+}
+
+static void flash_save(void)
+{
+	union
+	{
+		struct keymap_flash keymap;
+		uint8_t bytes[FLASH_IMAGE_SIZE];
+	} image;
+
+	memset(&image, 0xFF, sizeof(image));
+
+	image.keymap.magic = FLASH_MAGIC;
+	image.keymap.num_layers = KEYMAP_LAYER_LAST;
+	image.keymap.num_keys = KEYMAP_NUM_KEYS;
+	image.keymap.base_layer = self.base_layer;
+	memcpy(image.keymap.keys, self.keys, sizeof(self.keys));
+	image.keymap.checksum = flash_checksum(&image.keymap);
+
+	// nothing may run from flash while it's written to, on either core
+	input_core_pause();
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	flash_range_erase(FLASH_OFFSET, FLASH_SECTOR_SIZE);
+	flash_range_program(FLASH_OFFSET, image.bytes, sizeof(image.bytes));
+
+	restore_interrupts(irq_state);
+	input_core_resume();
+
+	self.flash_valid = flash_is_valid(flash_keymap());
+}
+
+uint8_t keymap_get(enum keymap_layer layer, uint8_t key_idx)
+{
+	if ((layer >= KEYMAP_LAYER_LAST) || (key_idx >= KEYMAP_NUM_KEYS))
+		return KEYMAP_KEY_NONE;
+
+	return self.keys[layer][key_idx];
+}
+
+void keymap_set(enum keymap_layer layer, uint8_t key_idx, uint8_t key)
+{
+	if ((layer >= KEYMAP_LAYER_LAST) || (key_idx >= KEYMAP_NUM_KEYS))
+		return;
+
+	// REG_ID_STR couldn't tell a press of the key from a release
+	if (!is_valid_key(key))
+		return;
+
+	self.keys[layer][key_idx] = key;
+	self.version++;
+}
+
+enum keymap_layer keymap_get_base_layer(void)
+{
+	return self.base_layer;
+}
+
+void keymap_set_base_layer(uint8_t layer)
+{
+	// only the user layers can stand in for the base layer
+	if ((layer < KEYMAP_LAYER_USER1) || (layer >= KEYMAP_LAYER_LAST))
+		layer = KEYMAP_LAYER_BASE;
+
+	self.base_layer = layer;
+	self.version++;
+}
+
+uint32_t keymap_get_version(void)
+{
+	return self.version;
+}
+
+// move on to the next key, wrapping to the first key of the next layer
+static void port_advance(void)
+{
+	uint8_t layer = reg_get_value(REG_ID_KML);
+	uint8_t key_idx = reg_get_value(REG_ID_KMK) + 1;
+
+	if (key_idx >= KEYMAP_NUM_KEYS) {
+		key_idx = 0;
+		layer++;
+	}
+
+	reg_set_value(REG_ID_KML, layer);
+	reg_set_value(REG_ID_KMK, key_idx);
+}
+
+uint8_t keymap_port_read(void)
+{
+	const uint8_t key = keymap_get(reg_get_value(REG_ID_KML), reg_get_value(REG_ID_KMK));
+
+	port_advance();
+
+	return key;
+}
+
+void keymap_port_write(uint8_t data)
+{
+	keymap_set(reg_get_value(REG_ID_KML), reg_get_value(REG_ID_KMK), data);
+
+	port_advance();
+}
+
+uint8_t keymap_get_status(void)
+{
+	uint8_t status = 0;
+
+	status |= self.save_requested ? KEYMAP_STA_SAVING : 0x00;
+	status |= self.flash_valid    ? KEYMAP_STA_FLASH  : 0x00;
+
+	return status;
+}
+
+void keymap_command(uint8_t cmd)
+{
+	switch (cmd) {
+	case KEYMAP_CMD_SAVE:
+		self.save_requested = true;
+		break;
+
+	case KEYMAP_CMD_LOAD:
+		flash_load();
+		break;
+
+	case KEYMAP_CMD_RESET:
+		self.fill_defaults();
+		keymap_set_base_layer(KEYMAP_LAYER_BASE);
+		break;
+
+	default:
+		break;
+	}
+}
+
+void keymap_task(void)
+{
+	if (!self.save_requested)
+		return;
+
+	flash_save();
+
+	self.save_requested = false;
+}
+
+void keymap_init(void (*fill_defaults)(void))
+{
+	self.fill_defaults = fill_defaults;
+
+	self.fill_defaults();
+
+	flash_load();
+}
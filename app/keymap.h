@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define KEYMAP_NUM_KEYS		((NUM_OF_ROWS * NUM_OF_COLS) + NUM_OF_BTNS)
+
+#define KEYMAP_KEY_NONE		0x00 // the key doesn't report anything on this layer
+#define KEYMAP_KEY_TRNS		0xFF // transparent, the key falls through to the layer below
+#define KEYMAP_KEY_MAX		0x7F // key codes have to fit the 7 bits REG_ID_STR has for them
+
+enum keymap_layer
+{
+	KEYMAP_LAYER_BASE = 0,
+	KEYMAP_LAYER_SHIFT,
+	KEYMAP_LAYER_ALT,
+	KEYMAP_LAYER_SYM,
+	KEYMAP_LAYER_USER1, // user layers replace the base layer when selected with REG_ID_KBL
+	KEYMAP_LAYER_USER2,
+	KEYMAP_LAYER_USER3,
+	KEYMAP_LAYER_USER4,
+
+	KEYMAP_LAYER_LAST,
+};
+
+#define KEYMAP_CMD_SAVE		0x01 // write the keymap to flash
+#define KEYMAP_CMD_LOAD		0x02 // discard any changes and reload the keymap from flash
+#define KEYMAP_CMD_RESET	0x03 // restore the built-in keymap, without touching flash
+
+#define KEYMAP_STA_SAVING	(1 << 0) // a save is queued or in progress
+#define KEYMAP_STA_FLASH	(1 << 1) // the keymap in flash is valid
+
+uint8_t keymap_get(enum keymap_layer layer, uint8_t key_idx);
+void keymap_set(enum keymap_layer layer, uint8_t key_idx, uint8_t key);
+
+// the layer standing in for the base layer, KEYMAP_LAYER_BASE or one of the user layers
+enum keymap_layer keymap_get_base_layer(void);
+void keymap_set_base_layer(uint8_t layer);
+
+// changes on every modification, so users can tell when cached lookups need to be redone
+uint32_t keymap_get_version(void);
+
+// register interface, REG_ID_KMD reads and writes the key at REG_ID_KML:REG_ID_KMK and advances it
+uint8_t keymap_port_read(void);
+void keymap_port_write(uint8_t data);
+uint8_t keymap_get_status(void);
+void keymap_command(uint8_t cmd);
+
+// flash can only be written from thread mode, so saving is done from here
+void keymap_task(void);
+
+// fill_defaults gets called to set up the built-in keymap, before loading the one in flash if any
+void keymap_init(void (*fill_defaults)(void));
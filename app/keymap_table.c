@@ -0,0 +1,102 @@
+#include "keymap_table.h"
+
+#include "reg.h"
+
+// Sym over Alt over Shift, then the selected base layer and the built-in one. Shift falling
+// through to a base layer makes its letters uppercase, so the user layers get a Shift of their own.
+char keymap_table_lookup(uint32_t key_idx, uint8_t layers)
+{
+	uint8_t key = KEYMAP_KEY_TRNS;
+	bool upper = false;
+
+	if (layers & KEYMAP_TABLE_SYM)
+		key = keymap_get(KEYMAP_LAYER_SYM, key_idx);
+
+	if ((key == KEYMAP_KEY_TRNS) && (layers & KEYMAP_TABLE_ALT))
+		key = keymap_get(KEYMAP_LAYER_ALT, key_idx);
+
+	if ((key == KEYMAP_KEY_TRNS) && (layers & KEYMAP_TABLE_SHIFT)) {
+		key = keymap_get(KEYMAP_LAYER_SHIFT, key_idx);
+		upper = (key == KEYMAP_KEY_TRNS);
+	}
+
+	if (key == KEYMAP_KEY_TRNS)
+		key = keymap_get(keymap_get_base_layer(), key_idx);
+
+	if (key == KEYMAP_KEY_TRNS)
+		key = keymap_get(KEYMAP_LAYER_BASE, key_idx);
+
+	if (upper && (key >= 'a' && key <= 'z'))
+		key -= ' ';
+
+	return (key == KEYMAP_KEY_TRNS) ? KEYMAP_KEY_NONE : (char)key;
+}
+
+static char effective_key(const struct keymap_entry * const p_entry, uint32_t key_idx, uint8_t cfg, uint8_t layers)
+{
+	char key = p_entry->chr;
+
+	switch (p_entry->mod) {
+		case KEY_MOD_ID_ALT:
+			if (cfg & CFG_REPORT_MODS)
+				key = KEY_MOD_ALT;
+			break;
+
+		case KEY_MOD_ID_SHL:
+			if (cfg & CFG_REPORT_MODS)
+				key = KEY_MOD_SHL;
+			break;
+
+		case KEY_MOD_ID_SHR:
+			if (cfg & CFG_REPORT_MODS)
+				key = KEY_MOD_SHR;
+			break;
+
+		case KEY_MOD_ID_SYM:
+			if (cfg & CFG_REPORT_MODS)
+				key = KEY_MOD_SYM;
+			break;
+
+		default:
+		{
+			if (cfg & CFG_USE_MODS)
+				key = keymap_table_lookup(key_idx, layers);
+
+			break;
+		}
+	}
+
+	return key;
+}
+
+void keymap_table_build(char table[KEYMAP_TABLE_LAYERS][KEYMAP_NUM_KEYS], uint8_t cfg, keymap_entry_func_t entry)
+{
+	for (uint32_t layers = 0; layers < KEYMAP_TABLE_LAYERS; ++layers) {
+		for (uint32_t i = 0; i < KEYMAP_NUM_KEYS; ++i)
+			table[layers][i] = effective_key(entry(i), i, cfg, layers);
+	}
+}
+
+void keymap_table_fill_defaults(keymap_entry_func_t entry)
+{
+	for (uint32_t i = 0; i < KEYMAP_NUM_KEYS; ++i) {
+		const struct keymap_entry * const p_entry = entry(i);
+		const char key = p_entry->chr;
+		const bool is_button = (key <= KEY_BTN_RIGHT1) || ((key >= KEY_BTN_LEFT2) && (key <= KEY_BTN_RIGHT2));
+
+		for (uint32_t layer = 0; layer < KEYMAP_LAYER_LAST; ++layer)
+			keymap_set(layer, i, KEYMAP_KEY_TRNS);
+
+		// mods keep their function whatever the keymap says
+		if (p_entry->mod != KEY_MOD_ID_NONE)
+			continue;
+
+		keymap_set(KEYMAP_LAYER_BASE, i, (key >= 'A' && key <= 'Z') ? (key + ' ') : key);
+
+		// everything else comes out right from the base layer, uppercased where it's a letter
+		if (key >= 'a' && key <= 'z')
+			keymap_set(KEYMAP_LAYER_SHIFT, i, key);
+
+		keymap_set(KEYMAP_LAYER_ALT, i, is_button ? key : p_entry->alt);
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "keyboard.h"
+#include "keymap.h"
+
+#include <stdint.h>
+
+// modifier layers active at the same time, the table holds every combination
+#define KEYMAP_TABLE_SHIFT		(1 << 0) // Shift held or Caps Lock on
+#define KEYMAP_TABLE_ALT		(1 << 1) // Alt held or Num Lock on
+#define KEYMAP_TABLE_SYM		(1 << 2) // Sym held
+#define KEYMAP_TABLE_LAYERS		8
+
+// what the board prints on a key
+struct keymap_entry
+{
+	char chr;
+	char alt;
+	enum key_mod mod;
+};
+
+// gives the entry of every key, matrix and buttons alike
+typedef const struct keymap_entry *(*keymap_entry_func_t)(uint32_t);
+
+// the key reported on the given layers, the topmost layer that isn't transparent for the key wins
+char keymap_table_lookup(uint32_t key_idx, uint8_t layers);
+
+// precompute the key reported for every key on every combination of layers, cfg being REG_ID_CFG
+void keymap_table_build(char table[KEYMAP_TABLE_LAYERS][KEYMAP_NUM_KEYS], uint8_t cfg, keymap_entry_func_t entry);
+
+// the built-in keymap, what the entries report with CFG_USE_MODS set
+void keymap_table_fill_defaults(keymap_entry_func_t entry);
@@ -4,9 +4,12 @@
 
 #include "backlight.h"
 #include "debug.h"
+#include "events.h"
 #include "gpioexp.h"
+#include "input_core.h"
 #include "interrupt.h"
 #include "keyboard.h"
+#include "keymap.h"
 #include "puppet_i2c.h"
 #include "reg.h"
 #include "touchpad.h"
@@ -16,6 +19,7 @@
 static void gpio_irq(uint gpio, uint32_t events)
 {
 //	printf("%s: gpio %d, events 0x%02X\r\n", __func__, gpio, events);
+	keyboard_gpio_irq(gpio, events);
 	touchpad_gpio_irq(gpio, events);
 	gpioexp_gpio_irq(gpio, events);
 }
@@ -36,9 +40,11 @@ int main(void)
 
 	gpioexp_init();
 
-	keyboard_init();
+	// keyboard and touchpad, possibly on core1
+	input_core_init();
 
-	touchpad_init();
+	// ahead of the interrupts, so the events are in the stream once the host is told
+	events_init();
 
 	interrupt_init();
 
@@ -53,6 +59,10 @@ int main(void)
 
 	while (true) {
 		__wfe();
+
+		keymap_task();
+
+		puppet_i2c_task();
 	}
 
 	return 0;
@@ -6,7 +6,10 @@
 #include <hardware/irq.h>
 #include <pico/stdlib.h>
 
-#define REG_ID_INVALID		0x00
+#define BUS_SPEED_UNIT_HZ	(100 * 1000) // REG_ID_ISP unit
+#define BUS_SPEED_FMP_HZ	(1000 * 1000) // Fast-mode Plus needs more drive
+
+#define TX_REFILL_LEVEL		8 // top up the TX FIFO once this few bytes are left, half of it
 
 static i2c_inst_t *i2c_instances[2] = { i2c0, i2c1 };
 
@@ -14,44 +17,141 @@ static struct
 {
 	i2c_inst_t *i2c;
 
-	struct
-	{
-		uint8_t reg;
-		uint8_t data;
-	} read_buffer;
+	uint8_t write_reg; // where the next data byte of a write goes
+
+	struct reg_burst read;
+	bool read_started; // a read request was served since the register byte
+	uint8_t unclocked; // bytes left in the TX FIFO at the end of a read, given back to the burst
 
-	uint8_t write_buffer[2];
-	uint8_t write_len;
+	volatile bool speed_changed; // REG_ID_ISP got written, applied once the bus is idle
 } self;
 
-static void irq_handler(void)
+// A read cut short leaves the rest of what was queued in the TX FIFO, the hardware flushes it
+// when the next read request comes. Give it back to the burst so it gets sent again, data port
+// bytes are popped already and would be lost otherwise.
+static void give_back(uint8_t left)
 {
-	// the controller sent data
-	if (self.i2c->hw->intr_stat & I2C_IC_INTR_MASK_M_RX_FULL_BITS) {
-		if (self.read_buffer.reg == REG_ID_INVALID) {
-			self.read_buffer.reg = self.i2c->hw->data_cmd & 0xff;
+	// the leftovers can be seen more than once before they're flushed, only count them once
+	if (left > self.unclocked) {
+		self.read.idx -= MIN(left - self.unclocked, self.read.idx);
+		self.unclocked = left;
+	}
+}
+
+static void end_transaction(void)
+{
+	// nothing more may go in behind the leftovers, they're all going to be flushed
+	hw_clear_bits(&self.i2c->hw->intr_mask, I2C_IC_INTR_MASK_M_TX_EMPTY_BITS);
+
+	give_back(self.i2c->hw->txflr);
+}
+
+static void receive_byte(const uint32_t data_cmd)
+{
+	const uint8_t data = (data_cmd & 0xff);
+
+	// the first byte of a transaction is the register
+	if (data_cmd & I2C_IC_DATA_CMD_FIRST_DATA_BYTE_BITS) {
+		// a repeated start doesn't STOP the read before
+		end_transaction();
+		self.read_started = false;
 
-			if (self.read_buffer.reg & PACKET_WRITE_MASK) {
-				// it'sq a reg write, we need to wait for the second byte before we process
-				return;
-			}
+		if (data & PACKET_WRITE_MASK) {
+			// it's a reg write, the data bytes follow
+			self.write_reg = (data & ~PACKET_WRITE_MASK);
 		} else {
-			self.read_buffer.data = self.i2c->hw->data_cmd & 0xff;
+			self.write_reg = REG_ID_INVALID;
+
+			// a data port read cut short carries on where the controller stopped
+			const bool resume = (data == self.read.reg) && (reg_burst_next_reg(data, false) == data) && reg_burst_pending(&self.read);
+			if (!resume)
+				reg_burst_start(&self.read, FIFO_READER_I2C, data);
 		}
 
-		reg_process_packet(self.read_buffer.reg, self.read_buffer.data, self.write_buffer, &self.write_len);
+		return;
+	}
+
+	// every further byte of a write goes to the next register
+	if (self.write_reg == REG_ID_INVALID)
+		return;
+
+	reg_write(FIFO_READER_I2C, self.write_reg, data);
+
+	self.write_reg = reg_burst_next_reg(self.write_reg, true);
+}
+
+// Queue the rest of the current register, and keep the FIFO topped up from the TX empty irq
+// until it's all in, so the controller never has to wait in the middle of a register. Moving on
+// to the next register is left to the read requests, reading it may have side effects.
+static void transmit(void)
+{
+	while (reg_burst_pending(&self.read) && i2c_get_write_available(self.i2c))
+		self.i2c->hw->data_cmd = reg_burst_read(&self.read);
+
+	if (reg_burst_pending(&self.read))
+		hw_set_bits(&self.i2c->hw->intr_mask, I2C_IC_INTR_MASK_M_TX_EMPTY_BITS);
+	else
+		hw_clear_bits(&self.i2c->hw->intr_mask, I2C_IC_INTR_MASK_M_TX_EMPTY_BITS);
+}
+
+static void irq_handler(void)
+{
+	// The controller stopped reading before the end, the leftovers got flushed when it came
+	// back with a read request. The hardware keeps flushing the TX FIFO until the abort is
+	// cleared, so this has to go first, before anything is queued for that read request.
+	if (self.i2c->hw->intr_stat & I2C_IC_INTR_MASK_M_TX_ABRT_BITS) {
+		hw_clear_bits(&self.i2c->hw->intr_mask, I2C_IC_INTR_MASK_M_TX_EMPTY_BITS);
+
+		// a read coming right after a repeated start, without a register byte, is the first
+		// time the leftovers show up
+		give_back((self.i2c->hw->tx_abrt_source & I2C_IC_TX_ABRT_SOURCE_TX_FLUSH_CNT_BITS) >> I2C_IC_TX_ABRT_SOURCE_TX_FLUSH_CNT_LSB);
+		self.unclocked = 0;
+
+		self.i2c->hw->clr_tx_abrt;
+	}
+
+	// the read before is over, see give_back
+	if (self.i2c->hw->intr_stat & I2C_IC_INTR_MASK_M_STOP_DET_BITS) {
+		self.i2c->hw->clr_stop_det;
 
-		// ready for the next operation
-		self.read_buffer.reg = REG_ID_INVALID;
+		end_transaction();
+	}
+
+	// the controller sent data
+	if (self.i2c->hw->intr_stat & I2C_IC_INTR_MASK_M_RX_FULL_BITS) {
+		while (i2c_get_read_available(self.i2c))
+			receive_byte(self.i2c->hw->data_cmd);
 
 		return;
 	}
 
-	// the controller requested a read
+	// the controller requested a read, it's holding the clock low until it gets a byte
 	if (self.i2c->hw->intr_stat & I2C_IC_INTR_MASK_M_RD_REQ_BITS) {
-		i2c_write_raw_blocking(self.i2c, self.write_buffer, self.write_len);
+		const uint32_t start_time = time_us_32();
 
+		// the hardware flushes anything in the TX FIFO before a read request, so the
+		// first byte can't go in ahead of time. Any later request means the FIFO ran dry.
+		if (self.read_started)
+			reg_set_value(REG_ID_ISC, MIN(reg_get_value(REG_ID_ISC) + 1, UINT8_MAX));
+
+		// the reply was prepared when the register byte came in, possibly this moves on to
+		// the next register
+		self.i2c->hw->data_cmd = reg_burst_read(&self.read);
 		self.i2c->hw->clr_rd_req;
+
+		const uint32_t stretch = MIN(time_us_32() - start_time, UINT8_MAX);
+		if (stretch > reg_get_value(REG_ID_IST))
+			reg_set_value(REG_ID_IST, stretch);
+
+		self.read_started = true;
+
+		transmit();
+		return;
+	}
+
+	// the TX FIFO is getting low
+	if (self.i2c->hw->intr_stat & I2C_IC_INTR_MASK_M_TX_EMPTY_BITS) {
+		transmit();
 		return;
 	}
 }
@@ -61,6 +161,44 @@ void puppet_i2c_sync_address(void)
 	i2c_set_slave_mode(self.i2c, true, reg_get_value(REG_ID_ADR));
 }
 
+static void apply_speed(void)
+{
+	const uint32_t speed = MAX(reg_get_value(REG_ID_ISP), 1) * BUS_SPEED_UNIT_HZ;
+
+	// as a slave this only sets the spike filter and the SDA hold time, which is what
+	// has to match the bus speed
+	i2c_set_baudrate(self.i2c, speed);
+
+	// the edges have to be sharp enough for 1MHz, SCL too as it gets held low while stretching.
+	// The bus pull-ups need to be strong enough too, the internal ones aren't.
+	const bool fmp = (speed >= BUS_SPEED_FMP_HZ);
+	gpio_set_slew_rate(PIN_PUPPET_SDA, fmp ? GPIO_SLEW_RATE_FAST : GPIO_SLEW_RATE_SLOW);
+	gpio_set_drive_strength(PIN_PUPPET_SDA, fmp ? GPIO_DRIVE_STRENGTH_12MA : GPIO_DRIVE_STRENGTH_4MA);
+	gpio_set_slew_rate(PIN_PUPPET_SCL, fmp ? GPIO_SLEW_RATE_FAST : GPIO_SLEW_RATE_SLOW);
+	gpio_set_drive_strength(PIN_PUPPET_SCL, fmp ? GPIO_DRIVE_STRENGTH_12MA : GPIO_DRIVE_STRENGTH_4MA);
+}
+
+void puppet_i2c_sync_speed(void)
+{
+	// this comes in the middle of the write setting it, changing the speed disables the block
+	// which would abort the rest of the transaction
+	self.speed_changed = true;
+}
+
+void puppet_i2c_task(void)
+{
+	if (!self.speed_changed)
+		return;
+
+	// the STOP irq wakes the main loop up again
+	if (self.i2c->hw->status & I2C_IC_STATUS_SLV_ACTIVITY_BITS)
+		return;
+
+	self.speed_changed = false;
+
+	apply_speed();
+}
+
 void puppet_i2c_init(void)
 {
 	// determine the instance based on SCL pin, hope you didn't screw up the SDA pin!
@@ -68,6 +206,7 @@ void puppet_i2c_init(void)
 
 	i2c_init(self.i2c, 100 * 1000);
 	puppet_i2c_sync_address();
+	apply_speed();
 
 	gpio_set_function(PIN_PUPPET_SDA, GPIO_FUNC_I2C);
 	gpio_pull_up(PIN_PUPPET_SDA);
@@ -75,8 +214,11 @@ void puppet_i2c_init(void)
 	gpio_set_function(PIN_PUPPET_SCL, GPIO_FUNC_I2C);
 	gpio_pull_up(PIN_PUPPET_SCL);
 
-	// irq when the controller sends data, and when it requests a read
-	self.i2c->hw->intr_mask = I2C_IC_INTR_MASK_M_RD_REQ_BITS | I2C_IC_INTR_MASK_M_RX_FULL_BITS;
+	// irq when the controller sends data, when it requests a read, when it cuts a read short and
+	// on STOP, the TX empty irq gets enabled while a reply is being sent
+	self.i2c->hw->tx_tl = TX_REFILL_LEVEL;
+	self.i2c->hw->intr_mask = I2C_IC_INTR_MASK_M_RD_REQ_BITS | I2C_IC_INTR_MASK_M_RX_FULL_BITS | I2C_IC_INTR_MASK_M_TX_ABRT_BITS |
+							  I2C_IC_INTR_MASK_M_STOP_DET_BITS;
 
 	const int irq = I2C0_IRQ + i2c_hw_index(self.i2c);
 	irq_set_exclusive_handler(irq, irq_handler);
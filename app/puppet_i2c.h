@@ -1,5 +1,9 @@
 #pragma once
 
 void puppet_i2c_sync_address(void);
+void puppet_i2c_sync_speed(void);
+
+// speed changes are applied from here, once the bus is idle
+void puppet_i2c_task(void);
 
 void puppet_i2c_init(void);
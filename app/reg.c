@@ -2,12 +2,16 @@
 
 #include "app_config.h"
 #include "backlight.h"
+#include "events.h"
 #include "fifo.h"
 #include "gpioexp.h"
+#include "interrupt.h"
+#include "keymap.h"
 #include "puppet_i2c.h"
 #include "keyboard.h"
 #include "touchpad.h"
 
+#include <hardware/sync.h>
 #include <pico/stdlib.h>
 #include <RP2040.h> // TODO: When there's more than one RP chip, change this to be more generic
 #include <stdio.h>
@@ -18,9 +22,27 @@
 static struct
 {
 	uint8_t regs[REG_ID_LAST];
+
+	// REG_ID_TOM, latched and cleared together
+	int16_t motion_x;
+	int16_t motion_y;
+	bool motion_overflow;
+
+	// REG_ID_SPL:REG_ID_SPH, taken over in one go when the high byte is written
+	volatile uint16_t scan_period;
 } self;
 
-static void touch_cb(int8_t x, int8_t y)
+static int16_t motion_add(int16_t acc, int16_t delta)
+{
+	const int32_t sum = acc + delta;
+
+	if ((sum < INT16_MIN) || (sum > INT16_MAX))
+		self.motion_overflow = true;
+
+	return MAX(INT16_MIN, MIN(sum, INT16_MAX));
+}
+
+static void touch_cb(int16_t x, int16_t y)
 {
 	const int16_t dx = (int8_t)self.regs[REG_ID_TOX] + x;
 	const int16_t dy = (int8_t)self.regs[REG_ID_TOY] + y;
@@ -28,10 +50,45 @@ static void touch_cb(int8_t x, int8_t y)
 	// bind to -128 to 127
 	self.regs[REG_ID_TOX] = MAX(INT8_MIN, MIN(dx, INT8_MAX));
 	self.regs[REG_ID_TOY] = MAX(INT8_MIN, MIN(dy, INT8_MAX));
+
+	// a read of REG_ID_TOM must see both axes or neither
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	self.motion_x = motion_add(self.motion_x, x);
+	self.motion_y = motion_add(self.motion_y, y);
+
+	restore_interrupts(irq_state);
 }
 static struct touch_callback touch_callback = { .func = touch_cb };
 
-void reg_process_packet(uint8_t in_reg, uint8_t in_data, uint8_t *out_buffer, uint8_t *out_len)
+// writing these does nothing, reading most of them has side effects
+static bool is_read_only(uint8_t reg)
+{
+	switch (reg) {
+	case REG_ID_VER:
+	case REG_ID_KEY:
+	case REG_ID_FIF:
+	case REG_ID_TOX:
+	case REG_ID_TOY:
+	case REG_ID_GHC:
+	case REG_ID_SDL:
+	case REG_ID_SDH:
+	case REG_ID_FIT:
+	case REG_ID_FIC:
+	case REG_ID_DRA:
+	case REG_ID_IST:
+	case REG_ID_ISC:
+	case REG_ID_STR:
+	case REG_ID_EVT:
+	case REG_ID_TOM:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+void reg_process_packet(enum fifo_reader reader, uint8_t in_reg, uint8_t in_data, uint8_t *out_buffer, uint8_t *out_len)
 {
 	const bool is_write = (in_reg & PACKET_WRITE_MASK);
 	const uint8_t reg = (in_reg & ~PACKET_WRITE_MASK);
@@ -40,21 +97,38 @@ void reg_process_packet(uint8_t in_reg, uint8_t in_data, uint8_t *out_buffer, ui
 
 	*out_len = 0;
 
+	// a burst write can run over them, it mustn't pop or clear anything
+	if (is_write && is_read_only(reg))
+		return;
+
 	switch (reg) {
 
 	// common R/W registers
 	case REG_ID_CFG:
-	case REG_ID_INT:
 	case REG_ID_DEB:
 	case REG_ID_FRQ:
 	case REG_ID_BKL:
 	case REG_ID_BK2:
 	case REG_ID_GIC:
-	case REG_ID_GIN:
 	case REG_ID_HLD:
 	case REG_ID_ADR:
 	case REG_ID_IND:
 	case REG_ID_CF2:
+	case REG_ID_IDL:
+	case REG_ID_SPL:
+	case REG_ID_SPH:
+	case REG_ID_KML:
+	case REG_ID_KMK:
+	case REG_ID_DRN:
+	case REG_ID_IWM:
+	case REG_ID_IHO:
+	case REG_ID_ISP:
+	case REG_ID_FIK:
+	case REG_ID_FIS:
+	case REG_ID_FVK:
+	case REG_ID_FVS:
+	case REG_ID_FHK:
+	case REG_ID_FHS:
 	{
 		if (is_write) {
 			reg_set_value(reg, in_data);
@@ -69,6 +143,30 @@ void reg_process_packet(uint8_t in_reg, uint8_t in_data, uint8_t *out_buffer, ui
 				puppet_i2c_sync_address();
 				break;
 
+			case REG_ID_SPH:
+				// a single halfword store, the scan never sees half of a new period
+				self.scan_period = (reg_get_value(REG_ID_SPH) << 8) | reg_get_value(REG_ID_SPL);
+				keyboard_sync_scan();
+				break;
+
+			case REG_ID_FRQ:
+			case REG_ID_IDL:
+				keyboard_sync_scan();
+				break;
+
+			case REG_ID_ISP:
+				// the SDK can't set up the I2C block for much faster than 1MHz
+				reg_set_value(reg, MIN(in_data, ISP_MAX));
+				puppet_i2c_sync_speed();
+				break;
+
+			case REG_ID_CF2:
+				if (!reg_is_bit_set(REG_ID_CF2, CF2_EVENT_STREAM))
+					events_flush();
+
+				interrupt_sync();
+				break;
+
 			default:
 				break;
 			}
@@ -80,6 +178,28 @@ void reg_process_packet(uint8_t in_reg, uint8_t in_data, uint8_t *out_buffer, ui
 	}
 
 	// special R/W registers
+	case REG_ID_INT:
+	case REG_ID_GIN:
+	{
+		if (is_write) {
+			reg_set_value(reg, in_data);
+		} else {
+			// in level mode the I2C host reading clears, nothing raised in between may get lost
+			const uint32_t irq_state = save_and_disable_interrupts();
+
+			out_buffer[0] = reg_get_value(reg);
+			*out_len = sizeof(uint8_t);
+
+			if ((reader == FIFO_READER_I2C) && reg_is_bit_set(REG_ID_CF2, CF2_INT_LEVEL))
+				reg_set_value(reg, 0);
+
+			restore_interrupts(irq_state);
+		}
+
+		interrupt_sync();
+		break;
+	}
+
 	case REG_ID_DIR: // gpio direction
 	case REG_ID_PUE: // gpio input pull enable
 	case REG_ID_PUD: // gpio input pull direction
@@ -114,34 +234,225 @@ void reg_process_packet(uint8_t in_reg, uint8_t in_data, uint8_t *out_buffer, ui
 		break;
 	}
 
+	case REG_ID_KMD: // keymap port data
+	{
+		if (is_write) {
+			keymap_port_write(in_data);
+		} else {
+			out_buffer[0] = keymap_port_read();
+			*out_len = sizeof(uint8_t);
+		}
+		break;
+	}
+
+	case REG_ID_KMC: // keymap command/status
+	{
+		if (is_write) {
+			keymap_command(in_data);
+		} else {
+			out_buffer[0] = keymap_get_status();
+			*out_len = sizeof(uint8_t);
+		}
+		break;
+	}
+
+	case REG_ID_KBL: // keymap base layer
+	{
+		if (is_write) {
+			keymap_set_base_layer(in_data);
+		} else {
+			out_buffer[0] = keymap_get_base_layer();
+			*out_len = sizeof(uint8_t);
+		}
+		break;
+	}
+
 	// read-only registers
 	case REG_ID_TOX:
 	case REG_ID_TOY:
+	case REG_ID_IST:
+	case REG_ID_ISC:
 		out_buffer[0] = reg_get_value(reg);
 		*out_len = sizeof(uint8_t);
 
 		reg_set_value(reg, 0);
 		break;
 
+	case REG_ID_TOM:
+	{
+		// latch and clear both axes at once, so no motion lands in between
+		const uint32_t irq_state = save_and_disable_interrupts();
+
+		const int16_t x = self.motion_x;
+		const int16_t y = self.motion_y;
+		const bool overflow = self.motion_overflow;
+
+		self.motion_x = 0;
+		self.motion_y = 0;
+		self.motion_overflow = false;
+
+		restore_interrupts(irq_state);
+
+		out_buffer[0] = overflow ? TOM_OVERFLOW : 0x00;
+		out_buffer[1] = (uint8_t)((uint16_t)x >> 0);
+		out_buffer[2] = (uint8_t)((uint16_t)x >> 8);
+		out_buffer[3] = (uint8_t)((uint16_t)y >> 0);
+		out_buffer[4] = (uint8_t)((uint16_t)y >> 8);
+		*out_len = sizeof(uint8_t) * 5;
+		break;
+	}
+
+	case REG_ID_GHC:
+		out_buffer[0] = keyboard_take_ghost_count();
+		*out_len = sizeof(uint8_t);
+		break;
+
+	case REG_ID_SDL:
+	{
+		const uint16_t duration = keyboard_take_scan_duration();
+
+		out_buffer[0] = (duration & 0xFF);
+		*out_len = sizeof(uint8_t);
+
+		reg_set_value(REG_ID_SDH, (duration >> 8));
+		break;
+	}
+
+	case REG_ID_SDH:
+		out_buffer[0] = reg_get_value(reg);
+		*out_len = sizeof(uint8_t);
+		break;
+
 	case REG_ID_VER:
 		out_buffer[0] = VER_VAL;
 		*out_len = sizeof(uint8_t);
 		break;
 
 	case REG_ID_KEY:
-		out_buffer[0] = fifo_count();
-		out_buffer[0] |= keyboard_get_numlock()  ? KEY_NUMLOCK  : 0x00;
-		out_buffer[0] |= keyboard_get_capslock() ? KEY_CAPSLOCK : 0x00;
+		out_buffer[0] = MIN(fifo_count(reader), KEY_COUNT_MASK);
+		out_buffer[0] |= keyboard_get_numlock()     ? KEY_NUMLOCK  : 0x00;
+		out_buffer[0] |= keyboard_get_capslock()    ? KEY_CAPSLOCK : 0x00;
+		out_buffer[0] |= fifo_take_overflow(reader) ? KEY_OVERFLOW : 0x00;
 		*out_len = sizeof(uint8_t);
 		break;
 
+	case REG_ID_FIC:
+	{
+		const uint16_t count = fifo_count(reader);
+
+		out_buffer[0] = (uint8_t)(count >> 0);
+		out_buffer[1] = (uint8_t)(count >> 8);
+		*out_len = sizeof(uint8_t) * 2;
+		break;
+	}
+
 	case REG_ID_FIF:
 	{
-		const struct fifo_item item = fifo_dequeue();
+		const struct fifo_item item = fifo_dequeue(reader);
 
 		out_buffer[0] = (uint8_t)item.state;
 		out_buffer[1] = (uint8_t)item.key;
 		*out_len = sizeof(uint8_t) * 2;
+
+		interrupt_sync();
+		break;
+	}
+
+	case REG_ID_FIT:
+	{
+		const struct fifo_item item = fifo_dequeue(reader);
+
+		// an empty FIFO reports the current time instead, so the host can line up the clocks
+		const uint32_t time = (item.state == KEY_STATE_IDLE) ? time_us_32() : item.time;
+
+		out_buffer[0] = (uint8_t)item.state;
+		out_buffer[1] = (uint8_t)item.key;
+		out_buffer[2] = (uint8_t)(time >> 0);
+		out_buffer[3] = (uint8_t)(time >> 8);
+		out_buffer[4] = (uint8_t)(time >> 16);
+		out_buffer[5] = (uint8_t)(time >> 24);
+		*out_len = sizeof(uint8_t) * 6;
+
+		interrupt_sync();
+		break;
+	}
+
+	case REG_ID_STR:
+	{
+		const struct fifo_item item = fifo_dequeue(reader);
+
+		// key codes are 7-bit, the top bit is free to tell the states apart. Presses or taps,
+		// whichever is the most common in the mode, get a single byte, the other one is escaped.
+		const enum key_state single = reg_is_bit_set(REG_ID_CF2, CF2_COMPACT_EVENTS) ? KEY_STATE_TAP : KEY_STATE_PRESSED;
+
+		switch (item.state) {
+		case KEY_STATE_PRESSED:
+		case KEY_STATE_TAP:
+			if (item.state == single) {
+				out_buffer[0] = (uint8_t)item.key;
+				*out_len = sizeof(uint8_t);
+			} else {
+				out_buffer[0] = STR_RELEASED;
+				out_buffer[1] = STR_RELEASED | (uint8_t)item.key;
+				*out_len = sizeof(uint8_t) * 2;
+			}
+			break;
+
+		case KEY_STATE_RELEASED:
+			out_buffer[0] = STR_RELEASED | (uint8_t)item.key;
+			*out_len = sizeof(uint8_t);
+			break;
+
+		case KEY_STATE_HOLD:
+			out_buffer[0] = STR_RELEASED;
+			out_buffer[1] = (uint8_t)item.key;
+			*out_len = sizeof(uint8_t) * 2;
+			break;
+
+		default:
+			out_buffer[0] = STR_END;
+			*out_len = sizeof(uint8_t);
+			break;
+		}
+
+		interrupt_sync();
+		break;
+	}
+
+	case REG_ID_EVT:
+	{
+		const struct event event = events_pop();
+
+		out_buffer[0] = event.type;
+		out_buffer[1] = event.data[0];
+		out_buffer[2] = event.data[1];
+		out_buffer[3] = event.data[2];
+		*out_len = sizeof(uint8_t) * 4;
+
+		interrupt_sync();
+		break;
+	}
+
+	case REG_ID_DRA:
+	{
+		const uint8_t batch = MIN(reg_get_value(REG_ID_DRN), DRAIN_MAX_EVENTS);
+		uint8_t count = 0;
+
+		// the read is always the full batch long, so the host knows how much to read up front
+		for (uint8_t i = 0; i < batch; ++i) {
+			const struct fifo_item item = fifo_dequeue(reader);
+
+			out_buffer[1 + (i * 2)] = (uint8_t)item.state;
+			out_buffer[2 + (i * 2)] = (uint8_t)item.key;
+
+			if (item.state != KEY_STATE_IDLE)
+				count++;
+		}
+
+		out_buffer[0] = count;
+		*out_len = sizeof(uint8_t) * (1 + (batch * 2));
+
+		interrupt_sync();
 		break;
 	}
 
@@ -151,11 +462,81 @@ void reg_process_packet(uint8_t in_reg, uint8_t in_data, uint8_t *out_buffer, ui
 	}
 }
 
+void reg_write(enum fifo_reader reader, uint8_t reg, uint8_t data)
+{
+	// writes don't reply, this is only there to satisfy reg_process_packet
+	uint8_t scratch[PACKET_MAX_READ_LEN];
+	uint8_t scratch_len;
+
+	reg_process_packet(reader, reg | PACKET_WRITE_MASK, data, scratch, &scratch_len);
+}
+
+uint8_t reg_burst_next_reg(uint8_t reg, bool is_write)
+{
+	switch (reg) {
+	// data ports, a burst keeps streaming from them
+	case REG_ID_KMD:
+		return reg;
+
+	// read-only data ports, a write burst moves on past them
+	case REG_ID_FIF:
+	case REG_ID_FIT:
+	case REG_ID_DRA:
+	case REG_ID_STR:
+	case REG_ID_EVT:
+		if (!is_write)
+			return reg;
+		break;
+
+	default:
+		break;
+	}
+
+	reg++;
+
+	// a burst never runs into the reset
+	if ((reg == REG_ID_RST) || (reg >= REG_ID_LAST))
+		return REG_ID_INVALID;
+
+	return reg;
+}
+
+void reg_burst_start(struct reg_burst *burst, enum fifo_reader reader, uint8_t reg)
+{
+	burst->reader = reader;
+	burst->reg = reg;
+	burst->idx = 0;
+
+	reg_process_packet(reader, reg, 0, burst->buffer, &burst->len);
+}
+
+uint8_t reg_burst_read(struct reg_burst *burst)
+{
+	// only read the next register once it's needed, reading some of them has side effects
+	while ((burst->idx >= burst->len) && (burst->reg != REG_ID_INVALID))
+		reg_burst_start(burst, burst->reader, reg_burst_next_reg(burst->reg, false));
+
+	if (burst->idx >= burst->len)
+		return 0x00;
+
+	return burst->buffer[burst->idx++];
+}
+
+uint8_t reg_burst_pending(const struct reg_burst *burst)
+{
+	return (burst->len - burst->idx);
+}
+
 uint8_t reg_get_value(enum reg_id reg)
 {
 	return self.regs[reg];
 }
 
+uint16_t reg_get_scan_period(void)
+{
+	return self.scan_period;
+}
+
 void reg_set_value(enum reg_id reg, uint8_t value)
 {
 #ifdef DEBUG_REGS
@@ -192,14 +573,25 @@ void reg_init(void)
 {
 	reg_set_value(REG_ID_CFG, CFG_OVERFLOW_INT | CFG_KEY_INT | CFG_USE_MODS);
 	reg_set_value(REG_ID_BKL, 255);
-	reg_set_value(REG_ID_DEB, 10);
+	reg_set_value(REG_ID_DEB, 10);	// ms
 	reg_set_value(REG_ID_FRQ, 10);	// ms
 	reg_set_value(REG_ID_BK2, 255);
 	reg_set_value(REG_ID_PUD, 0xFF);
 	reg_set_value(REG_ID_HLD, 30);	// 10ms units
 	reg_set_value(REG_ID_ADR, 0x1F);
 	reg_set_value(REG_ID_IND, 1);	// ms
-	reg_set_value(REG_ID_CF2, CF2_TOUCH_INT | CF2_USB_KEYB_ON | CF2_USB_MOUSE_ON);
+	reg_set_value(REG_ID_CF2, CF2_TOUCH_INT | CF2_USB_KEYB_ON | CF2_USB_MOUSE_ON | CF2_EAGER_DEBOUNCE);
+	reg_set_value(REG_ID_IDL, 50);	// 10ms units
+	reg_set_value(REG_ID_DRN, 8);	// events
+	reg_set_value(REG_ID_IWM, 1);	// events
+	reg_set_value(REG_ID_IHO, 10);	// ms
+	reg_set_value(REG_ID_ISP, 1);	// 100kHz units
+	reg_set_value(REG_ID_FIK, FLT_KEYS_ALL);
+	reg_set_value(REG_ID_FIS, FLT_SRC_ALL);
+	reg_set_value(REG_ID_FVK, FLT_KEYS_ALL);
+	reg_set_value(REG_ID_FVS, FLT_SRC_ALL);
+	reg_set_value(REG_ID_FHK, FLT_KEYS_ALL);
+	reg_set_value(REG_ID_FHS, FLT_SRC_ALL);
 
 	touchpad_add_touch_callback(&touch_callback);
 }
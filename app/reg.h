@@ -1,16 +1,19 @@
 #pragma once
 
+#include "fifo.h"
+
 #include <stdbool.h>
 #include <stdint.h>
 
 enum reg_id
 {
+	REG_ID_INVALID = 0x00, // no register, reads return nothing
 	REG_ID_VER = 0x01, // fw version
 	REG_ID_CFG = 0x02, // config
 	REG_ID_INT = 0x03, // interrupt status
 	REG_ID_KEY = 0x04, // key status
 	REG_ID_BKL = 0x05, // backlight
-	REG_ID_DEB = 0x06, // key debounce cfg (not implemented)
+	REG_ID_DEB = 0x06, // key debounce time cfg (in ms)
 	REG_ID_FRQ = 0x07, // key poll freq cfg
 	REG_ID_RST = 0x08, // trigger a reset
 	REG_ID_FIF = 0x09, // key fifo
@@ -27,6 +30,35 @@ enum reg_id
 	REG_ID_CF2 = 0x14, // config 2
 	REG_ID_TOX = 0x15, // touch delta x since last read, at most (-128 to 127)
 	REG_ID_TOY = 0x16, // touch delta y since last read, at most (-128 to 127)
+	REG_ID_IDL = 0x17, // key scan idle timeout (in 10ms units, 0 disables)
+	REG_ID_GHC = 0x18, // number of key presses held back as possible ghosts since last read
+	REG_ID_SPL = 0x19, // key scan period cfg (in us, low byte), overrides REG_ID_FRQ if not 0
+	REG_ID_SPH = 0x1A, // key scan period cfg (in us, high byte), writing it applies both bytes
+	REG_ID_SDL = 0x1B, // longest key scan duration since last read (in us, low byte)
+	REG_ID_SDH = 0x1C, // longest key scan duration, high byte latched when reading REG_ID_SDL
+	REG_ID_FIT = 0x1D, // key fifo with event timestamp
+	REG_ID_KML = 0x1E, // keymap port layer
+	REG_ID_KMK = 0x1F, // keymap port key index
+	REG_ID_KMD = 0x20, // keymap port data, advances to the next key on every access
+	REG_ID_KMC = 0x21, // keymap command (write) and status (read)
+	REG_ID_KBL = 0x22, // keymap layer standing in for the base layer
+	REG_ID_FIC = 0x23, // number of keys in the fifo (2 bytes)
+	REG_ID_DRN = 0x24, // key fifo drain batch size cfg (in events)
+	REG_ID_DRA = 0x25, // key fifo drain, a count followed by a batch of events
+	REG_ID_IWM = 0x26, // interrupt coalescing watermark cfg (in events, 0 or 1 disables)
+	REG_ID_IHO = 0x27, // interrupt coalescing hold-off time cfg (in ms, 0 disables)
+	REG_ID_ISP = 0x28, // i2c puppet bus speed cfg (in 100kHz units)
+	REG_ID_IST = 0x29, // longest i2c read request service time since last read (in us)
+	REG_ID_ISC = 0x2A, // number of i2c reads stretched past the first byte since last read
+	REG_ID_STR = 0x2B, // key fifo stream, compact 1-2 byte records, stays selected across reads
+	REG_ID_FIK = 0x2C, // i2c host event filter, key states and classes
+	REG_ID_FIS = 0x2D, // i2c host event filter, sources
+	REG_ID_FVK = 0x2E, // usb vendor host event filter, key states and classes
+	REG_ID_FVS = 0x2F, // usb vendor host event filter, sources
+	REG_ID_FHK = 0x30, // usb hid event filter, key states and classes
+	REG_ID_FHS = 0x31, // usb hid event filter, sources
+	REG_ID_EVT = 0x32, // typed event stream, 4 byte records, stays selected across reads
+	REG_ID_TOM = 0x33, // touch delta x and y since last read, 16-bit each, read together (5 bytes)
 
 	REG_ID_LAST,
 };
@@ -43,6 +75,10 @@ enum reg_id
 #define CF2_TOUCH_INT		(1 << 0) // Should touch events generate interrupts
 #define CF2_USB_KEYB_ON		(1 << 1) // Should key events be sent over USB HID
 #define CF2_USB_MOUSE_ON	(1 << 2) // Should touch events be sent over USB HID
+#define CF2_EAGER_DEBOUNCE	(1 << 3) // Should key changes be reported on the first edge instead of after the debounce time
+#define CF2_INT_LEVEL		(1 << 4) // Should the interrupt pin stay asserted until everything was read, with REG_ID_INT cleared on read
+#define CF2_COMPACT_EVENTS	(1 << 5) // Should press/release pairs go in the FIFO as a single tap, with taps as single byte REG_ID_STR records
+#define CF2_EVENT_STREAM	(1 << 6) // Should key, touch, gpio and lock events go in the REG_ID_EVT stream as well
 // TODO? CF2_STICKY_MODS // Pressing and releasing a mod affects next key pressed
 
 #define INT_OVERFLOW		(1 << 0)
@@ -56,8 +92,29 @@ enum reg_id
 
 #define KEY_CAPSLOCK		(1 << 5) // Caps lock status
 #define KEY_NUMLOCK			(1 << 6) // Num lock status
+#define KEY_OVERFLOW		(1 << 7) // The FIFO overflowed for the reader since it last read this
 #define KEY_COUNT_MASK		0x1F
 
+#define FLT_PRESSED			(1 << 0) // event filter: key states
+#define FLT_HOLD			(1 << 1)
+#define FLT_RELEASED		(1 << 2)
+#define FLT_PRINTABLE		(1 << 3) // event filter: key classes, anything not in the other two
+#define FLT_MODS			(1 << 4) // Alt, Sym and Shifts, when reported
+#define FLT_NAV				(1 << 5) // joystick and buttons
+#define FLT_KEYS_ALL		0x3F
+
+#define FLT_SRC_KEYBOARD	(1 << 0) // event filter: sources, same order as enum key_source
+#define FLT_SRC_SWIPE		(1 << 1)
+#define FLT_SRC_GPIO		(1 << 2)
+#define FLT_SRC_ALL			0x07
+
+#define ISP_MAX				10 // REG_ID_ISP: 1MHz, Fast-mode Plus
+
+#define TOM_OVERFLOW		(1 << 0) // REG_ID_TOM: an axis saturated since the last read
+
+#define STR_END				0x00 // stream record: the FIFO is empty
+#define STR_RELEASED		(1 << 7) // stream record: set on the key for a release, alone it escapes a record with the key next
+
 #define DIR_OUTPUT			0
 #define DIR_INPUT			1
 
@@ -67,12 +124,39 @@ enum reg_id
 #define VER_VAL				((VERSION_MAJOR << 4) | (VERSION_MINOR << 0))
 
 #define PACKET_WRITE_MASK	(1 << 7)
+#define DRAIN_MAX_EVENTS	31 // largest REG_ID_DRA batch, so it fits a single USB packet
+
+#define PACKET_MAX_READ_LEN	(1 + (DRAIN_MAX_EVENTS * 2)) // longest register read, REG_ID_DRA
 
-void reg_process_packet(uint8_t in_reg, uint8_t in_data, uint8_t *out_buffer, uint8_t *out_len);
+// Sequential access to consecutive registers, a read of one register carries on with the next
+// ones once its bytes ran out
+struct reg_burst
+{
+	enum fifo_reader reader; // the FIFO registers read at the host's own position
+	uint8_t reg;
+	uint8_t buffer[PACKET_MAX_READ_LEN];
+	uint8_t len;
+	uint8_t idx;
+};
+
+void reg_process_packet(enum fifo_reader reader, uint8_t in_reg, uint8_t in_data, uint8_t *out_buffer, uint8_t *out_len);
+
+// a single register write, it leaves any read burst in progress alone
+void reg_write(enum fifo_reader reader, uint8_t reg, uint8_t data);
+
+// the register a burst moves on to after reg, REG_ID_INVALID at the end
+uint8_t reg_burst_next_reg(uint8_t reg, bool is_write);
+
+void reg_burst_start(struct reg_burst *burst, enum fifo_reader reader, uint8_t reg);
+uint8_t reg_burst_read(struct reg_burst *burst);
+uint8_t reg_burst_pending(const struct reg_burst *burst);
 
 uint8_t reg_get_value(enum reg_id reg);
 void reg_set_value(enum reg_id reg, uint8_t value);
 
+// the key scan period last set with REG_ID_SPL:REG_ID_SPH, in us
+uint16_t reg_get_scan_period(void);
+
 bool reg_is_bit_set(enum reg_id reg, uint8_t bit);
 void reg_set_bit(enum reg_id reg, uint8_t bit);
 void reg_clear_bit(enum reg_id reg, uint8_t bit);
@@ -1,5 +1,6 @@
 #include "touchpad.h"
 
+#include "input_core.h"
 #include "keyboard.h"
 
 #include <hardware/i2c.h>
@@ -19,6 +20,13 @@
 #define REG_OBSERV			0x2E
 #define REG_MBURST			0x42
 
+// what a REG_MBURST read returns, in order
+#define MBURST_MOTION		0
+#define MBURST_DELTA_X		1
+#define MBURST_DELTA_Y		2
+#define MBURST_DELTA_XY_H	3 // x in the high nibble, y in the low one
+#define MBURST_LEN			4
+
 #define BIT_MOTION_MOT		(1 << 7)
 #define BIT_MOTION_OVF		(1 << 4)
 
@@ -42,14 +50,21 @@ static struct
 	i2c_inst_t *i2c;
 } self;
 
-static uint8_t read_register8(uint8_t reg)
+// motion, delta x, delta y and their high bits in one go
+static void read_motion_burst(uint8_t *buffer)
 {
-	uint8_t val;
+	const uint8_t reg = REG_MBURST;
 
 	i2c_write_blocking(self.i2c, DEV_ADDR, &reg, sizeof(reg), true);
-	i2c_read_blocking(self.i2c, DEV_ADDR, &val, sizeof(val), false);
+	i2c_read_blocking(self.i2c, DEV_ADDR, buffer, MBURST_LEN, false);
+}
 
-	return val;
+// 12-bit two's complement from the low byte and the high nibble
+static int16_t delta12(uint8_t low, uint8_t high)
+{
+	const int16_t delta = (int16_t)(((high & 0x0F) << 8) | low);
+
+	return (delta & 0x800) ? (delta - 0x1000) : delta;
 }
 
 //static void write_register8(uint8_t reg, uint8_t val)
@@ -58,13 +73,26 @@ static uint8_t read_register8(uint8_t reg)
 //	i2c_write_blocking(self.i2c, DEV_ADDR, buffer, sizeof(buffer), false);
 //}
 
+static void dispatch_touch_event(uint16_t x, uint16_t y, uint32_t time)
+{
+	(void)time;
+
+	struct touch_callback *cb = self.callbacks;
+
+	while (cb) {
+		cb->func((int16_t)x, (int16_t)y);
+
+		cb = cb->next;
+	}
+}
+
 int64_t release_key(alarm_id_t id, void *user_data)
 {
 	(void)id;
 
 	const int data = (int)user_data;
 
-	keyboard_inject_event((char)data, KEY_STATE_RELEASED);
+	keyboard_inject_event((char)data, KEY_STATE_RELEASED, KEY_SOURCE_SWIPE);
 
 	return 0;
 }
@@ -77,13 +105,12 @@ void touchpad_gpio_irq(uint gpio, uint32_t events)
 	if (!(events & GPIO_IRQ_EDGE_FALL))
 		return;
 
-	const uint8_t motion = read_register8(REG_MOTION);
-	if (motion & BIT_MOTION_MOT) {
-		int8_t x = read_register8(REG_DELTA_X);
-		int8_t y = read_register8(REG_DELTA_Y);
+	uint8_t burst[MBURST_LEN];
+	read_motion_burst(burst);
 
-		x = ((x < 127) ? x : (x - 256)) * -1;
-		y = ((y < 127) ? y : (y - 256));
+	if (burst[MBURST_MOTION] & BIT_MOTION_MOT) {
+		const int16_t x = delta12(burst[MBURST_DELTA_X], burst[MBURST_DELTA_XY_H] >> 4) * -1;
+		const int16_t y = delta12(burst[MBURST_DELTA_Y], burst[MBURST_DELTA_XY_H]);
 
 		if (keyboard_is_mod_on(KEY_MOD_ID_ALT)) {
 			if (to_ms_since_boot(get_absolute_time()) - self.last_swipe_time > SWIPE_COOLDOWN_TIME_MS) {
@@ -95,24 +122,17 @@ void touchpad_gpio_irq(uint gpio, uint32_t events)
 				}
 
 				if (key != '\0') {
-					keyboard_inject_event(key, KEY_STATE_PRESSED);
+					keyboard_inject_event(key, KEY_STATE_PRESSED, KEY_SOURCE_SWIPE);
 
 					// we need to allow the usb a bit of time to send the press, so schedule the release after a bit
-					add_alarm_in_ms(SWIPE_RELEASE_DELAY_MS, release_key, (void*)(int)key, true);
+					alarm_pool_add_alarm_in_ms(input_core_get_alarm_pool(), SWIPE_RELEASE_DELAY_MS, release_key, (void*)(int)key, true);
 
 					self.last_swipe_time = to_ms_since_boot(get_absolute_time());
 				}
 			}
 		} else {
-			if (self.callbacks) {
-				struct touch_callback *cb = self.callbacks;
-
-				while (cb) {
-					cb->func(x, y);
-
-					cb = cb->next;
-				}
-			}
+			if (self.callbacks)
+				input_core_defer(dispatch_touch_event, x, y);
 		}
 	}
 }
@@ -5,7 +5,7 @@
 
 struct touch_callback
 {
-	void (*func)(int8_t, int8_t);
+	void (*func)(int16_t, int16_t); // deltas, 12-bit signed
 	struct touch_callback *next;
 };
 
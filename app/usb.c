@@ -18,8 +18,7 @@ static struct
 	bool mouse_moved;
 	uint8_t mouse_btn;
 
-	uint8_t write_buffer[2];
-	uint8_t write_len;
+	struct reg_burst read;
 } self;
 
 // TODO: What about Ctrl?
@@ -92,16 +91,17 @@ static void key_cb(char key, enum key_state state)
 		}
 	}
 }
-static struct key_callback key_callback = { .func = key_cb };
+static struct key_callback key_callback = { .func = key_cb, .filter_reg = REG_ID_FHK };
 
-static void touch_cb(int8_t x, int8_t y)
+static void touch_cb(int16_t x, int16_t y)
 {
 	if (!tud_hid_n_ready(USB_ITF_MOUSE) || !reg_is_bit_set(REG_ID_CF2, CF2_USB_MOUSE_ON))
 		return;
 
 	self.mouse_moved = true;
 
-	tud_hid_n_mouse_report(USB_ITF_MOUSE, 0, self.mouse_btn, x, y, 0, 0);
+	// a report only carries 8-bit deltas
+	tud_hid_n_mouse_report(USB_ITF_MOUSE, 0, self.mouse_btn, MAX(INT8_MIN, MIN(x, INT8_MAX)), MAX(INT8_MIN, MIN(y, INT8_MAX)), 0, 0);
 }
 static struct touch_callback touch_callback = { .func = touch_cb };
 
@@ -132,12 +132,36 @@ void tud_vendor_rx_cb(uint8_t itf)
 //	printf("%s: itf: %d, avail: %d\r\n", __func__, itf, tud_vendor_n_available(itf));
 
 	uint8_t buff[64] = { 0 };
-	tud_vendor_n_read(itf, buff, 64);
+	const uint32_t len = tud_vendor_n_read(itf, buff, 64);
 //	printf("%s: %02X %02X %02X\r\n", __func__, buff[0], buff[1], buff[2]);
 
-	reg_process_packet(buff[0], buff[1], self.write_buffer, &self.write_len);
+	// same as over I2C, every data byte of a write goes to the next register
+	if (buff[0] & PACKET_WRITE_MASK) {
+		uint8_t reg = (buff[0] & ~PACKET_WRITE_MASK);
 
-	tud_vendor_n_write(itf, self.write_buffer, self.write_len);
+		for (uint32_t i = 1; (i < len) && (reg != REG_ID_INVALID); ++i) {
+			reg_write(FIFO_READER_USB, reg, buff[i]);
+
+			reg = reg_burst_next_reg(reg, true);
+		}
+
+		return;
+	}
+
+	reg_burst_start(&self.read, FIFO_READER_USB, buff[0]);
+
+	// a read returns the register, unless the second byte asks for that many bytes from
+	// consecutive registers, since USB can't clock them out one by one
+	const uint8_t read_len = (len > 1) ? MIN(buff[1], sizeof(buff)) : 0;
+	if (read_len == 0) {
+		tud_vendor_n_write(itf, self.read.buffer, self.read.len);
+		return;
+	}
+
+	for (uint32_t i = 0; i < read_len; ++i)
+		buff[i] = reg_burst_read(&self.read);
+
+	tud_vendor_n_write(itf, buff, read_len);
 }
 
 void tud_mount_cb(void)
@@ -6,7 +6,7 @@ _REG_CFG = 0x02  # config
 _REG_INT = 0x03  # interrupt status
 _REG_KEY = 0x04  # key status
 _REG_BKL = 0x05  # backlight
-_REG_DEB = 0x06  # debounce cfg
+_REG_DEB = 0x06  # debounce time cfg (in ms)
 _REG_FRQ = 0x07  # poll freq cfg
 _REG_RST = 0x08  # reset
 _REG_FIF = 0x09  # fifo
@@ -23,6 +23,35 @@ _REG_IND = 0x13  # interrupt pin assert duration
 _REG_CF2 = 0x14  # config 2
 _REG_TOX = 0x15  # touch delta x since last read, at most (-128 to 127)
 _REG_TOY = 0x16  # touch delta y since last read, at most (-128 to 127)
+_REG_IDL = 0x17  # key scan idle timeout (in 10ms units, 0 disables)
+_REG_GHC = 0x18  # number of key presses held back as possible ghosts since last read
+_REG_SPL = 0x19  # key scan period cfg (in us, low byte), overrides _REG_FRQ if not 0
+_REG_SPH = 0x1A  # key scan period cfg (in us, high byte), writing it applies both bytes
+_REG_SDL = 0x1B  # longest key scan duration since last read (in us, low byte)
+_REG_SDH = 0x1C  # longest key scan duration, high byte latched when reading _REG_SDL
+_REG_FIT = 0x1D  # key fifo with event timestamp
+_REG_KML = 0x1E  # keymap port layer
+_REG_KMK = 0x1F  # keymap port key index
+_REG_KMD = 0x20  # keymap port data, advances to the next key on every access
+_REG_KMC = 0x21  # keymap command (write) and status (read)
+_REG_KBL = 0x22  # keymap layer standing in for the base layer
+_REG_FIC = 0x23  # number of keys in the fifo (2 bytes)
+_REG_DRN = 0x24  # key fifo drain batch size cfg (in events)
+_REG_DRA = 0x25  # key fifo drain, a count followed by a batch of events
+_REG_IWM = 0x26  # interrupt coalescing watermark cfg (in events, 0 or 1 disables)
+_REG_IHO = 0x27  # interrupt coalescing hold-off time cfg (in ms, 0 disables)
+_REG_ISP = 0x28  # i2c puppet bus speed cfg (in 100kHz units)
+_REG_IST = 0x29  # longest i2c read request service time since last read (in us)
+_REG_ISC = 0x2A  # number of i2c reads stretched past the first byte since last read
+_REG_STR = 0x2B  # key fifo stream, compact 1-2 byte records, stays selected across reads
+_REG_FIK = 0x2C  # i2c host event filter, key states and classes
+_REG_FIS = 0x2D  # i2c host event filter, sources
+_REG_FVK = 0x2E  # usb vendor host event filter, key states and classes
+_REG_FVS = 0x2F  # usb vendor host event filter, sources
+_REG_FHK = 0x30  # usb hid event filter, key states and classes
+_REG_FHS = 0x31  # usb hid event filter, sources
+_REG_EVT = 0x32  # typed event stream, 4 byte records, stays selected across reads
+_REG_TOM = 0x33  # touch delta x and y since last read, 16-bit each, read together (5 bytes)
 
 _WRITE_MASK      = 1 << 7
 
@@ -38,6 +67,10 @@ CFG_USE_MODS     = 1 << 7
 CF2_TOUCH_INT    = 1 << 0
 CF2_USB_KEYB_ON  = 1 << 1
 CF2_USB_MOUSE_ON = 1 << 2
+CF2_EAGER_DEBOUNCE = 1 << 3
+CF2_INT_LEVEL    = 1 << 4
+CF2_COMPACT_EVENTS = 1 << 5
+CF2_EVENT_STREAM = 1 << 6
 
 INT_OVERFLOW     = 1 << 0
 INT_CAPSLOCK     = 1 << 1
@@ -49,8 +82,51 @@ INT_TOUCH        = 1 << 6
 
 KEY_CAPSLOCK     = 1 << 5
 KEY_NUMLOCK      = 1 << 6
+KEY_OVERFLOW     = 1 << 7
 KEY_COUNT_MASK   = 0x1F
 
+EVT_NONE         = 0
+EVT_KEY          = 1
+EVT_MOTION       = 2
+EVT_GPIO         = 3
+EVT_LOCK         = 4
+
+TOM_OVERFLOW     = 1 << 0
+
+STR_END          = 0x00
+STR_RELEASED     = 1 << 7
+
+FLT_PRESSED      = 1 << 0
+FLT_HOLD         = 1 << 1
+FLT_RELEASED     = 1 << 2
+FLT_PRINTABLE    = 1 << 3
+FLT_MODS         = 1 << 4
+FLT_NAV          = 1 << 5
+
+FLT_SRC_KEYBOARD = 1 << 0
+FLT_SRC_SWIPE    = 1 << 1
+FLT_SRC_GPIO     = 1 << 2
+
+KEYMAP_LAYER_BASE  = 0
+KEYMAP_LAYER_SHIFT = 1
+KEYMAP_LAYER_ALT   = 2
+KEYMAP_LAYER_SYM   = 3
+KEYMAP_LAYER_USER1 = 4
+KEYMAP_LAYER_USER2 = 5
+KEYMAP_LAYER_USER3 = 6
+KEYMAP_LAYER_USER4 = 7
+
+KEYMAP_KEY_NONE    = 0x00
+KEYMAP_KEY_TRNS    = 0xFF
+KEYMAP_KEY_MAX     = 0x7F  # codes 0x80-0xFE are ignored, they don't fit _REG_STR
+
+KEYMAP_CMD_SAVE    = 0x01
+KEYMAP_CMD_LOAD    = 0x02
+KEYMAP_CMD_RESET   = 0x03
+
+KEYMAP_STA_SAVING  = 1 << 0
+KEYMAP_STA_FLASH   = 1 << 1
+
 DIR_OUTPUT       = 0
 DIR_INPUT        = 1
 
@@ -0,0 +1,183 @@
+#include "keymap_table.h"
+#include "reg.h"
+
+#include <stdio.h>
+
+// keymap storage, the flash side of keymap.c isn't needed to check the tables
+static uint8_t keys[KEYMAP_LAYER_LAST][KEYMAP_NUM_KEYS];
+static enum keymap_layer base_layer = KEYMAP_LAYER_BASE;
+
+uint8_t keymap_get(enum keymap_layer layer, uint8_t key_idx)
+{
+	return keys[layer][key_idx];
+}
+
+void keymap_set(enum keymap_layer layer, uint8_t key_idx, uint8_t key)
+{
+	keys[layer][key_idx] = key;
+}
+
+enum keymap_layer keymap_get_base_layer(void)
+{
+	return base_layer;
+}
+
+static struct keymap_entry entries[KEYMAP_NUM_KEYS];
+
+static const struct keymap_entry *entry(uint32_t key_idx)
+{
+	return &entries[key_idx];
+}
+
+// the key transition_to() reported before the keymap was precomputed, Sym had no layer of its own
+static char reference_key(const struct keymap_entry * const p_entry, uint8_t cfg, bool shift, bool alt)
+{
+	char key = p_entry->chr;
+	switch (p_entry->mod) {
+		case KEY_MOD_ID_ALT:
+			if (cfg & CFG_REPORT_MODS)
+				key = KEY_MOD_ALT;
+			break;
+
+		case KEY_MOD_ID_SHL:
+			if (cfg & CFG_REPORT_MODS)
+				key = KEY_MOD_SHL;
+			break;
+
+		case KEY_MOD_ID_SHR:
+			if (cfg & CFG_REPORT_MODS)
+				key = KEY_MOD_SHR;
+			break;
+
+		case KEY_MOD_ID_SYM:
+			if (cfg & CFG_REPORT_MODS)
+				key = KEY_MOD_SYM;
+			break;
+
+		default:
+		{
+			if (cfg & CFG_USE_MODS) {
+				const bool is_button = (key <= KEY_BTN_RIGHT1) || ((key >= KEY_BTN_LEFT2) && (key <= KEY_BTN_RIGHT2));
+
+				if (alt && !is_button) {
+					key = p_entry->alt;
+				} else if (!shift && (key >= 'A' && key <= 'Z')) {
+					key = (key + ' ');
+				}
+			}
+
+			break;
+		}
+	}
+
+	return key;
+}
+
+// compares every key of the batch on every layer combination and config, returns the number of mismatches
+static uint32_t check_batch(uint32_t num_keys)
+{
+	static const uint8_t cfgs[] = { 0, CFG_REPORT_MODS, CFG_USE_MODS, CFG_REPORT_MODS | CFG_USE_MODS };
+	static char table[KEYMAP_TABLE_LAYERS][KEYMAP_NUM_KEYS];
+	uint32_t errors = 0;
+
+	keymap_table_fill_defaults(entry);
+
+	for (uint32_t c = 0; c < sizeof(cfgs); ++c) {
+		keymap_table_build(table, cfgs[c], entry);
+
+		for (uint32_t layers = 0; layers < KEYMAP_TABLE_LAYERS; ++layers) {
+			for (uint32_t i = 0; i < num_keys; ++i) {
+				const bool shift = (layers & KEYMAP_TABLE_SHIFT);
+				const bool alt = (layers & KEYMAP_TABLE_ALT);
+				const char expected = reference_key(&entries[i], cfgs[c], shift, alt);
+
+				if (table[layers][i] == expected)
+					continue;
+
+				if (errors++ < 10)
+					printf("chr 0x%02X alt 0x%02X mod %d cfg 0x%02X layers 0x%02X: got 0x%02X, expected 0x%02X\n",
+						(uint8_t)entries[i].chr, (uint8_t)entries[i].alt, entries[i].mod, cfgs[c], (unsigned)layers,
+						(uint8_t)table[layers][i], (uint8_t)expected);
+			}
+		}
+	}
+
+	return errors;
+}
+
+static uint32_t check_key(const char table[KEYMAP_TABLE_LAYERS][KEYMAP_NUM_KEYS], uint32_t key_idx, uint8_t layers, char expected)
+{
+	if (table[layers][key_idx] == expected)
+		return 0;
+
+	printf("user layer key %u layers 0x%02X: got 0x%02X, expected 0x%02X\n",
+		(unsigned)key_idx, layers, (uint8_t)table[layers][key_idx], (uint8_t)expected);
+
+	return 1;
+}
+
+// a user layer selected as the base layer also decides what Shift gives, Alt is shared
+static uint32_t check_user_layer(void)
+{
+	static char table[KEYMAP_TABLE_LAYERS][KEYMAP_NUM_KEYS];
+	uint32_t errors = 0;
+
+	for (uint32_t i = 0; i < KEYMAP_NUM_KEYS; ++i)
+		entries[i] = (struct keymap_entry){ 'A', '1', KEY_MOD_ID_NONE };
+
+	keymap_table_fill_defaults(entry);
+
+	keymap_set(KEYMAP_LAYER_USER1, 0, 'q');
+	keymap_set(KEYMAP_LAYER_USER1, 1, ';');
+	base_layer = KEYMAP_LAYER_USER1;
+
+	keymap_table_build(table, CFG_USE_MODS, entry);
+
+	errors += check_key(table, 0, 0, 'q');
+	errors += check_key(table, 0, KEYMAP_TABLE_SHIFT, 'Q');
+	errors += check_key(table, 0, KEYMAP_TABLE_ALT, '1');
+	errors += check_key(table, 1, KEYMAP_TABLE_SHIFT, ';');
+	errors += check_key(table, 2, 0, 'a');
+	errors += check_key(table, 2, KEYMAP_TABLE_SHIFT, 'A');
+
+	base_layer = KEYMAP_LAYER_BASE;
+
+	return errors;
+}
+
+int main(void)
+{
+	uint32_t num_keys = 0;
+	uint32_t checked = 0;
+	uint32_t errors = 0;
+
+	// every entry a board can define, 0xFF is left out as it's the transparent key code and can't be stored
+	for (int mod = KEY_MOD_ID_NONE; mod < KEY_MOD_ID_LAST; ++mod) {
+		for (uint32_t chr = 0x00; chr < KEYMAP_KEY_TRNS; ++chr) {
+			for (uint32_t alt = 0x00; alt < KEYMAP_KEY_TRNS; ++alt) {
+				entries[num_keys].chr = chr;
+				entries[num_keys].alt = alt;
+				entries[num_keys].mod = mod;
+
+				if (++num_keys < KEYMAP_NUM_KEYS)
+					continue;
+
+				errors += check_batch(num_keys);
+				checked += num_keys;
+				num_keys = 0;
+			}
+		}
+	}
+
+	if (num_keys > 0) {
+		// the rest of the table still has the previous batch in it, which got checked already
+		errors += check_batch(num_keys);
+		checked += num_keys;
+	}
+
+	printf("%u entries checked, %u mismatches\n", (unsigned)checked, (unsigned)errors);
+
+	errors += check_user_layer();
+
+	return (errors == 0) ? 0 : 1;
+}